@@ -1,13 +1,17 @@
+#include <algorithm>
+#include <unordered_set>
 #include "Config.h"
 #include "CeresMap.h"
 #include "Tracker.h"
 #include <ceres/ceres.h>
-#include <ceres/rotation.h>
 #include <fstream>
 #include "Initializer.h"
 #include "Feature.h"
 #include "FourPointPnPRANSAC.h"
+#include "ThreadPool.h"
 #include "Triangulator.h"
+#include "Vocabulary.h"
+#include "KeyframeDatabase.h"
 #include "UDPSocket.h"
 
 #include <thread>
@@ -24,27 +28,86 @@
 
 using namespace slam;
 
-struct ReprojectFunctor {
-    ReprojectFunctor(const vec2d &x) : x(x) {}
+/*
+Rotation stored as the coefficients x, y, z, w of a quatd, updated by a rotation vector
+applied on the left: q' = exp(delta) q. The cost functions give their Jacobians directly
+with respect to delta in the first 3 columns, so the Jacobian here is [I 0]^T.
+*/
+class RotationParameterization : public ceres::LocalParameterization {
+public:
+    bool Plus(const double *x, const double *delta, double *x_plus_delta) const override {
+        Eigen::Map<const quatd> q(x);
+        Eigen::Map<const vec3d> d(delta);
+        Eigen::Map<quatd> q_plus(x_plus_delta);
+
+        double theta = d.norm();
+        quatd dq;
+        if (theta > 1e-12) {
+            dq = quatd(Eigen::AngleAxisd(theta, d / theta));
+        }
+        else {
+            dq = quatd(1.0, 0.5*d.x(), 0.5*d.y(), 0.5*d.z());
+        }
+        q_plus = (dq*q).normalized();
+        return true;
+    }
+
+    bool ComputeJacobian(const double *x, double *jacobian) const override {
+        Eigen::Map<Eigen::Matrix<double, 4, 3, Eigen::RowMajor>> J(jacobian);
+        J.setZero();
+        J.topRows<3>().setIdentity();
+        return true;
+    }
+
+    int GlobalSize() const override { return 4; }
+    int LocalSize() const override { return 3; }
+};
+
+// Normalized reprojection error of landmark p in the keyframe with rotation q and translation t.
+class ReprojectionCost : public ceres::SizedCostFunction<2, 3, 4, 3> {
+public:
+    ReprojectionCost(const vec2d &x) : x(x) {}
 
-    template <typename T>
-    bool operator() (const T* const p, const T* const r, const T* const t, T *residual) const {
-        T q[4];
-        q[0] = r[3]; // w
-        q[1] = r[0]; // x
-        q[2] = r[1]; // y
-        q[3] = r[2]; // z
+    bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const override {
+        Eigen::Map<const vec3d> p(parameters[0]);
+        Eigen::Map<const quatd> q(parameters[1]);
+        Eigen::Map<const vec3d> t(parameters[2]);
 
-        T rp[3];
-        ceres::QuaternionRotatePoint(q, p, rp);
+        mat3d R = q.toRotationMatrix();
+        vec3d rp = R*p;
+        vec3d pc = rp + t;
 
-        rp[0] += t[0];
-        rp[1] += t[1];
-        rp[2] += t[2];
+        double inv_z = 1.0 / pc.z();
+        residuals[0] = pc.x()*inv_z - x.x();
+        residuals[1] = pc.y()*inv_z - x.y();
 
-        residual[0] = rp[0] / rp[2] - T(x[0]);
-        residual[1] = rp[1] / rp[2] - T(x[1]);
+        if (jacobians == nullptr) {
+            return true;
+        }
 
+        // derivative of the projection by the point in the camera
+        Eigen::Matrix<double, 2, 3, Eigen::RowMajor> Jpc;
+        Jpc << inv_z, 0.0, -pc.x()*inv_z*inv_z,
+               0.0, inv_z, -pc.y()*inv_z*inv_z;
+
+        if (jacobians[0]) {
+            Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>> Jp(jacobians[0]);
+            Jp = Jpc*R;
+        }
+        if (jacobians[1]) {
+            // exp(delta) R p = R p + delta x R p
+            mat3d rp_cross;
+            rp_cross << 0.0, -rp.z(), rp.y(),
+                        rp.z(), 0.0, -rp.x(),
+                        -rp.y(), rp.x(), 0.0;
+            Eigen::Map<Eigen::Matrix<double, 2, 4, Eigen::RowMajor>> Jq(jacobians[1]);
+            Jq.leftCols<3>() = -Jpc*rp_cross;
+            Jq.col(3).setZero();
+        }
+        if (jacobians[2]) {
+            Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>> Jt(jacobians[2]);
+            Jt = Jpc;
+        }
         return true;
     }
 
@@ -52,37 +115,118 @@ private:
     const vec2d x;
 };
 
-CeresMap::CeresMap(const Config *config) {
+CeresMap::CeresMap(const Config *config)
+    : m_requests(1) // tracking hands over one keyframe at a time
+{
+    m_ransac_pool = std::make_unique<ThreadPool>((size_t)config->value("RANSAC.threads", 0));
     m_pnp = std::make_unique<FourPointPnPRANSAC>(config->K, 1.0f, 0.99f, 200);
+    m_pnp->set_thread_pool(m_ransac_pool.get());
+    m_pnp->set_seed((unsigned int)config->value("RANSAC.seed", 0));
+    m_pnp->set_local_optimization((size_t)config->value("RANSAC.localOptimization", 0));
     m_triangulator = std::make_unique<Triangulator>(config->K, 1.0f);
     m_K = config->K.cast<double>();
+
+    m_vocabulary = std::make_unique<Vocabulary>();
+    std::string vocabulary_file = config->text("Vocabulary.file", "", false);
+    if (!vocabulary_file.empty()) {
+        m_vocabulary->load(vocabulary_file);
+    }
+    m_database = std::make_unique<KeyframeDatabase>();
+    m_relocalization_candidates = (size_t)config->value("Relocalization.candidates", 5);
+    m_relocalization_min_inliers = (size_t)config->value("Relocalization.minInliers", 30);
+    m_local_window = (size_t)config->value("Map.localWindow", 10);
+
+    m_loss = std::make_unique<ceres::HuberLoss>(3.0 / m_K(0, 0));
+    m_quaternion = std::make_unique<RotationParameterization>();
+
+    publish(invalid_index);
+    if (config->value("Map.mappingThread", 1) != 0) {
+        m_mapping_thread = std::thread(&CeresMap::map_keyframes, this);
+    }
 }
 
-CeresMap::~CeresMap() = default;
+CeresMap::~CeresMap() {
+    {
+        std::lock_guard<std::mutex> lock(m_mapping_mutex);
+        m_stop = true;
+    }
+    m_mapping_condition.notify_all();
+    if (m_mapping_thread.joinable()) {
+        m_mapping_thread.join();
+    }
+}
 
 void slam::CeresMap::clear()
 {
+    wait_mapping();
     m_keyframes.clear();
     m_landmarks.clear();
-    m_last_keyframe.reset();
+    m_observers.clear();
+    m_landmark_active.clear();
+    m_problem.reset();
+    m_database->clear();
+    publish(invalid_index);
+    acquire_snapshot();
 }
 
-size_t CeresMap::add_keyframe(const std::shared_ptr<Frame> &pframe) {
-    size_t id = m_keyframes.size();
+index_t CeresMap::add_keyframe(const std::shared_ptr<Frame> &pframe) {
+    index_t id = (index_t)m_keyframes.size();
+    if (m_keyframes.size() == m_keyframes.capacity()) {
+        m_problem.reset();
+    }
     m_keyframes.push_back(Pose());
     m_keyframes[id].rotation = pframe->R.cast<double>();
     m_keyframes[id].translation = pframe->T.cast<double>();
+    m_keyframes[id].frame = pframe;
+    m_keyframes[id].landmark_map = pframe->landmark_map;
+    if (m_problem) {
+        add_pose_block(id);
+    }
+
+    const DescriptorArray *descriptors = pframe->feature->descriptors();
+    if (!m_vocabulary->empty() && descriptors) {
+        BowVector bow;
+        m_vocabulary->transform(*descriptors, bow);
+        m_database->add(id, bow);
+    }
+
     return id;
 }
 
-size_t CeresMap::add_landmark(const vec3 &point) {
-    size_t id = m_landmarks.size();
+index_t CeresMap::add_landmark(const vec3 &point) {
+    index_t id = (index_t)m_landmarks.size();
+    if (m_landmarks.size() == m_landmarks.capacity()) {
+        m_problem.reset();
+    }
     m_landmarks.push_back(point.cast<double>());
+    m_observers.emplace_back();
+    m_landmark_active.push_back(false);
     return id;
 }
 
-void CeresMap::add_observation(size_t keyframe, size_t landmark, const vec2 & x) {
-    m_keyframes[keyframe].observations[landmark] = x.cast<double>();
+void CeresMap::add_observation(index_t keyframe, index_t landmark, const vec2 & x) {
+    auto inserted = m_keyframes[keyframe].observations.emplace(landmark, x.cast<double>());
+    if (inserted.second) {
+        m_observers[landmark].push_back(keyframe);
+    }
+    else {
+        // the residual keeps the old observation
+        inserted.first->second = x.cast<double>();
+        m_problem.reset();
+    }
+
+    if (!m_problem || !inserted.second) {
+        return;
+    }
+    if (m_landmark_active[landmark]) {
+        if (m_keyframes[keyframe].state == Pose::OUTSIDE) {
+            add_pose_block(keyframe);
+        }
+        add_residual(keyframe, landmark);
+    }
+    else if (m_keyframes[keyframe].state == Pose::WINDOW) {
+        activate_landmark(landmark);
+    }
 }
 
 bool CeresMap::init(const std::shared_ptr<Frame> &current_frame, const Initializer *initializer) {
@@ -97,72 +241,62 @@ bool CeresMap::init(const std::shared_ptr<Frame> &current_frame, const Initializ
     f1->keyframe_id = add_keyframe(f1);
     f2->keyframe_id = add_keyframe(f2);
 
-    f2->landmark_map.swap(std::vector<size_t>(f2->feature->keypoints.size(), size_t(-1)));
+    f1->landmark_map.assign(f1->feature->keypoints.size(), invalid_index);
+    f2->landmark_map.assign(f2->feature->keypoints.size(), invalid_index);
     for (size_t i = 0; i < initializer->points.size(); ++i) {
-        size_t lmid = add_landmark(initializer->points[i]);
+        index_t lmid = add_landmark(initializer->points[i]);
+        f1->landmark_map[initializer->matches[i].first] = lmid;
         f2->landmark_map[initializer->matches[i].second] = lmid;
         add_observation(f1->keyframe_id, lmid, f1->feature->keypoints[initializer->matches[i].first]);
         add_observation(f2->keyframe_id, lmid, f2->feature->keypoints[initializer->matches[i].second]);
     }
 
-    // build problem;
-    ceres::Problem problem;
+    m_keyframes[f1->keyframe_id].landmark_map = f1->landmark_map;
+    m_keyframes[f2->keyframe_id].landmark_map = f2->landmark_map;
 
-    for (size_t i = 0; i < m_landmarks.size(); ++i) {
-        problem.AddParameterBlock(m_landmarks[i].data(), 3);
-    }
-
-    ceres::EigenQuaternionParameterization *quatparam = new ceres::EigenQuaternionParameterization();
-    ceres::LossFunction *huber = new ceres::HuberLoss(3.0/m_K(0, 0));
-
-    for (size_t i = 0; i < m_keyframes.size(); ++i) {
-        problem.AddParameterBlock(m_keyframes[i].rotation.coeffs().data(), 4, quatparam);
-        problem.AddParameterBlock(m_keyframes[i].translation.data(), 3);
-        problem.SetParameterBlockConstant(m_keyframes[i].translation.data());
-        for (auto &ob : m_keyframes[i].observations) {
-            ceres::CostFunction *r = new ceres::AutoDiffCostFunction<ReprojectFunctor, 2, 3, 4, 3>(new ReprojectFunctor(ob.second));
-            problem.AddResidualBlock(r, huber, m_landmarks[ob.first].data(), m_keyframes[i].rotation.coeffs().data(), m_keyframes[i].translation.data());
-        }
-    }
-
-    ceres::Solver::Options options;
-    options.linear_solver_type = ceres::SPARSE_SCHUR;
-    options.minimizer_progress_to_stdout = false;
-    ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    bool usable = bundle_adjust(0);
 
     f2->R = m_keyframes[f2->keyframe_id].rotation.cast<real>().toRotationMatrix();
     f2->T = m_keyframes[f2->keyframe_id].translation.cast<real>();
 
-    // latest frame is stored for matching next
-    m_last_keyframe = f2;
-    
+    // latest keyframe is matched against next
+    publish(f2->keyframe_id);
+    acquire_snapshot();
+
     send_visualization();
     //sleep3();
 
-    return summary.IsSolutionUsable();
+    return usable;
 }
 
 bool CeresMap::localize(const std::shared_ptr<Frame>& pframe)
 {
-    match_vector matches = m_last_keyframe->feature->match(pframe->feature.get(), 5, 0.3f);
+    acquire_snapshot();
+    const Reference &reference = *m_reference;
+
+    std::vector<real> quality;
+    match_vector matches = reference.keyframe->feature->match(pframe->feature.get(), 0.3f, nullptr, &quality);
     match_vector pnp_matches;
     match_vector image_matches;
+    std::vector<real> pnp_quality;
     pnp_matches.reserve(matches.size());
     image_matches.reserve(matches.size());
+    pnp_quality.reserve(matches.size());
 
     for (size_t i = 0; i < matches.size(); ++i) {
-        size_t mapped_landmark_id = m_last_keyframe->landmark_map[matches[i].first];
-        if (mapped_landmark_id != size_t(-1)) {
+        index_t mapped_landmark_id = reference.landmark_map[matches[i].first];
+        if (mapped_landmark_id != invalid_index) {
             pnp_matches.push_back(matches[i]);
             pnp_matches.back().first = mapped_landmark_id;
+            pnp_quality.push_back(quality[i]);
         }
         else {
             image_matches.push_back(matches[i]);
         }
     }
 
-    m_pnp->set_dataset(m_landmarks, pframe->feature->keypoints, pnp_matches);
+    m_pnp->set_dataset(m_tracking_snapshot->landmarks, pframe->feature->keypoints, pnp_matches);
+    m_pnp->set_quality(pnp_quality);
     m_pnp->run();
 
     if (m_pnp->matches.size() < max(pnp_matches.size()/5, 25)) {
@@ -172,99 +306,403 @@ bool CeresMap::localize(const std::shared_ptr<Frame>& pframe)
 
     pnp_matches.swap(m_pnp->matches);
 
-    auto &f1 = m_last_keyframe;
     auto &f2 = pframe;
     f2->R = m_pnp->R;
     f2->T = m_pnp->T;
 
-    vec3 p1 = -f1->R.transpose()*f1->T;
-    vec3 p2 = -f2->R.transpose()*f2->T;
+    // inlier landmarks, so tracking can follow them from this frame
+    f2->landmark_map.assign(f2->feature->keypoints.size(), invalid_index);
+    for (size_t i = 0; i < pnp_matches.size(); ++i) {
+        f2->landmark_map[pnp_matches[i].second] = pnp_matches[i].first;
+    }
 
-    real baseline = (p1 - p2).norm();
+    real relative_baseline = baseline(f2->R, f2->T);
 
-    std::cout << "Relative baseline: " << baseline << std::endl;
-    if (baseline < 1.0) {
+    std::cout << "Relative baseline: " << relative_baseline << std::endl;
+    if (relative_baseline < 1.0) {
         return true;
     }
 
-    f2->keyframe_id = add_keyframe(f2);
-    for (size_t i = 0; i < pnp_matches.size(); ++i) {
-        add_observation(f2->keyframe_id, pnp_matches[i].first, f2->feature->keypoints[pnp_matches[i].second]);
+    // one keyframe at a time, the next one is chosen against the map this one makes
+    if (m_tracking_snapshot->version != m_requested) {
+        return true;
     }
 
-    // build problem;
-    ceres::Problem problem;
-
-    for (size_t i = 0; i < m_landmarks.size(); ++i) {
-        problem.AddParameterBlock(m_landmarks[i].data(), 3);
+    KeyframeRequest request;
+    request.frame = pframe;
+    request.reference = reference.keyframe_id;
+    request.pnp_matches.swap(pnp_matches);
+    request.image_matches.swap(image_matches);
+    ++m_requested;
+
+    if (m_mapping_thread.joinable()) {
+        m_requests.push(std::move(request));
+        {
+            // the mapping thread either sees the request or is already waiting for the notification
+            std::lock_guard<std::mutex> lock(m_mapping_mutex);
+        }
+        m_mapping_condition.notify_all();
+    }
+    else {
+        map_keyframe(request);
     }
 
-    ceres::EigenQuaternionParameterization *quatparam = new ceres::EigenQuaternionParameterization();
-    ceres::LossFunction *huber = new ceres::HuberLoss(3.0 / m_K(0, 0));
+    return true;
+}
 
-    for (size_t i = 0; i < m_keyframes.size(); ++i) {
-        problem.AddParameterBlock(m_keyframes[i].rotation.coeffs().data(), 4, quatparam);
-        problem.AddParameterBlock(m_keyframes[i].translation.data(), 3);
-        if (i < 2) {
-            problem.SetParameterBlockConstant(m_keyframes[i].translation.data());
+void CeresMap::map_keyframes() {
+    KeyframeRequest request;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mapping_mutex);
+            m_mapping_condition.wait(lock, [this]() { return m_stop || !m_requests.empty(); });
+            if (m_stop) {
+                return;
+            }
         }
-        for (auto &ob : m_keyframes[i].observations) {
-            ceres::CostFunction *r = new ceres::AutoDiffCostFunction<ReprojectFunctor, 2, 3, 4, 3>(new ReprojectFunctor(ob.second));
-            problem.AddResidualBlock(r, huber, m_landmarks[ob.first].data(), m_keyframes[i].rotation.coeffs().data(), m_keyframes[i].translation.data());
+
+        m_requests.pop(request);
+        map_keyframe(request);
+        request = KeyframeRequest();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mapping_mutex);
         }
+        m_mapping_condition.notify_all();
     }
+}
 
-    ceres::Solver::Options options;
-    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-    options.minimizer_progress_to_stdout = false;
-    ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+void CeresMap::map_keyframe(const KeyframeRequest &request) {
+    auto &f2 = request.frame;
+    index_t id = add_keyframe(f2);
+    f2->keyframe_id = id;
+    for (auto &match : request.pnp_matches) {
+        add_observation(id, match.first, f2->feature->keypoints[match.second]);
+    }
 
-    if (!summary.IsSolutionUsable()) {
+    index_t first_keyframe = 0;
+    if (m_local_window > 0 && m_keyframes.size() > m_local_window) {
+        first_keyframe = (index_t)(m_keyframes.size() - m_local_window);
+    }
+    if (!bundle_adjust(first_keyframe)) {
         std::cout << "solve fail" << std::endl;
-        return false;
     }
 
-    f2->R = m_keyframes[f2->keyframe_id].rotation.cast<real>().toRotationMatrix();
-    f2->T = m_keyframes[f2->keyframe_id].translation.cast<real>();
-
-    std::vector<vec3> image_points;
+    // adjusted poses of both keyframes
+    const Pose &reference = m_keyframes[request.reference];
+    mat3 R1 = reference.rotation.cast<real>().toRotationMatrix();
+    vec3 T1 = reference.translation.cast<real>();
+    mat3 R2 = m_keyframes[id].rotation.cast<real>().toRotationMatrix();
+    vec3 T2 = m_keyframes[id].translation.cast<real>();
 
-    m_triangulator->set_dataset(m_last_keyframe->feature->keypoints, pframe->feature->keypoints, image_matches);
-    m_triangulator->R = f2->R*f1->R.transpose();
-    m_triangulator->T = f2->T - m_triangulator->R*f1->T;
+    m_triangulator->set_dataset(reference.frame->feature->keypoints, f2->feature->keypoints, request.image_matches);
+    m_triangulator->R = R2*R1.transpose();
+    m_triangulator->T = T2 - m_triangulator->R*T1;
     m_triangulator->triangulate();
 
+    std::vector<vec3> image_points;
+    match_vector image_matches;
     image_points.swap(m_triangulator->points);
     image_matches.swap(m_triangulator->matches);
 
-    mat3 RT = m_last_keyframe->R.transpose();
+    mat3 RT = R1.transpose();
     for (size_t i = 0; i < image_points.size(); ++i) {
-        vec3 pt = RT*(image_points[i] - m_last_keyframe->T);
+        vec3 pt = RT*(image_points[i] - T1);
         image_points[i] = pt;
     }
 
-    f2->landmark_map.swap(std::vector<size_t>(f2->feature->keypoints.size(), size_t(-1)));
-    for (size_t i = 0; i < pnp_matches.size(); ++i) {
-        f2->landmark_map[pnp_matches[i].second] = pnp_matches[i].first;
-    }
-
     for (size_t i = 0; i < image_points.size(); ++i) {
-        size_t lmid = add_landmark(image_points[i]);
-        f2->landmark_map[image_matches[i].second] = lmid;
-        add_observation(f1->keyframe_id, lmid, f1->feature->keypoints[image_matches[i].first]);
-        add_observation(f2->keyframe_id, lmid, f2->feature->keypoints[image_matches[i].second]);
+        index_t lmid = add_landmark(image_points[i]);
+        m_keyframes[request.reference].landmark_map[image_matches[i].first] = lmid;
+        m_keyframes[id].landmark_map[image_matches[i].second] = lmid;
+        add_observation(request.reference, lmid, m_keyframes[request.reference].frame->feature->keypoints[image_matches[i].first]);
+        add_observation(id, lmid, f2->feature->keypoints[image_matches[i].second]);
     }
 
-    m_last_keyframe = f2;
-
     send_visualization();
 
     std::cout << m_keyframes.size() << ": " << m_landmarks.size() << std::endl;
 
+    ++m_mapped;
+    publish(id);
+}
+
+bool CeresMap::localize_tracks(const KeypointArray &points, match_vector &tracks, mat3 &R, vec3 &T) {
+    acquire_snapshot();
+    m_pnp->set_dataset(m_tracking_snapshot->landmarks, points, tracks);
+    m_pnp->run();
+
+    if (m_pnp->matches.size() < std::max(tracks.size() / 5, (size_t)25)) {
+        return false;
+    }
+
+    R = m_pnp->R;
+    T = m_pnp->T;
+    tracks.swap(m_pnp->matches);
+
+    // a new keyframe needs features to triangulate from, leave it to localize
+    return baseline(R, T) < 1.0;
+}
+
+void CeresMap::set_time_budget(double seconds) {
+    m_pnp->set_time_budget(seconds);
+}
+
+bool CeresMap::relocalize(const std::shared_ptr<Frame> &pframe) {
+    wait_mapping();
+    acquire_snapshot();
+
+    const DescriptorArray *descriptors = pframe->feature->descriptors();
+    if (m_vocabulary->empty() || descriptors == nullptr || m_keyframes.empty()) {
+        return false;
+    }
+
+    BowVector bow;
+    m_vocabulary->transform(*descriptors, bow);
+
+    for (auto &candidate : m_database->query(bow, m_relocalization_candidates)) {
+        const Pose &keyframe = m_keyframes[candidate.first];
+        if (keyframe.landmark_map.empty()) {
+            continue;
+        }
+
+        // no pose prior, so match over the whole image
+        std::vector<real> quality;
+        match_vector matches = keyframe.frame->feature->match(pframe->feature.get(), 1.0e7f, nullptr, &quality);
+        match_vector pnp_matches;
+        std::vector<real> pnp_quality;
+        pnp_matches.reserve(matches.size());
+        pnp_quality.reserve(matches.size());
+        for (size_t i = 0; i < matches.size(); ++i) {
+            index_t mapped_landmark_id = keyframe.landmark_map[matches[i].first];
+            if (mapped_landmark_id != invalid_index) {
+                pnp_matches.emplace_back(mapped_landmark_id, matches[i].second);
+                pnp_quality.push_back(quality[i]);
+            }
+        }
+
+        if (pnp_matches.size() < m_relocalization_min_inliers) {
+            continue;
+        }
+
+        m_pnp->set_dataset(m_tracking_snapshot->landmarks, pframe->feature->keypoints, pnp_matches);
+        m_pnp->set_quality(pnp_quality);
+        m_pnp->run();
+
+        if (m_pnp->matches.size() < m_relocalization_min_inliers) {
+            continue;
+        }
+
+        pframe->R = m_pnp->R;
+        pframe->T = m_pnp->T;
+        pframe->landmark_map.assign(pframe->feature->keypoints.size(), invalid_index);
+        for (auto &match : m_pnp->matches) {
+            pframe->landmark_map[match.second] = match.first;
+        }
+
+        // resume tracking against the recognized keyframe, with its optimized pose
+        m_reference = make_reference(candidate.first);
+
+        std::cout << "Relocalized at keyframe " << candidate.first << " with " << m_pnp->matches.size() << " inliers" << std::endl;
+        return true;
+    }
+
+    return false;
+}
+
+bool CeresMap::optimize() {
+    wait_mapping();
+    acquire_snapshot();
+
+    if (m_keyframes.empty() || !bundle_adjust(0)) {
+        return false;
+    }
+    publish(m_reference->keyframe_id);
     return true;
 }
 
+void CeresMap::acquire_snapshot() {
+    std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot != m_tracking_snapshot) {
+        m_tracking_snapshot = snapshot;
+        m_reference = snapshot->reference;
+    }
+}
+
+void CeresMap::wait_mapping() {
+    std::unique_lock<std::mutex> lock(m_mapping_mutex);
+    m_mapping_condition.wait(lock, [this]() { return std::atomic_load(&m_snapshot)->version == m_requested; });
+}
+
+std::shared_ptr<const CeresMap::Reference> CeresMap::make_reference(index_t keyframe) const {
+    const Pose &pose = m_keyframes[keyframe];
+    auto reference = std::make_shared<Reference>();
+    reference->keyframe = pose.frame;
+    reference->keyframe_id = keyframe;
+    reference->R = pose.rotation.cast<real>().toRotationMatrix();
+    reference->T = pose.translation.cast<real>();
+    reference->landmark_map = pose.landmark_map;
+    return reference;
+}
+
+void CeresMap::publish(index_t reference) {
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->version = m_mapped;
+    snapshot->landmarks = m_landmarks;
+    if (reference != invalid_index) {
+        snapshot->reference = make_reference(reference);
+    }
+    std::atomic_store(&m_snapshot, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+}
+
+bool CeresMap::bundle_adjust(index_t first_keyframe) {
+    update_problem(first_keyframe);
+
+    // without older keyframes the window would float, hold its first keyframe instead
+    Pose &first = m_keyframes[first_keyframe];
+    bool unanchored = m_anchors == 0 && first_keyframe >= 2;
+    if (unanchored) {
+        m_problem->SetParameterBlockConstant(first.rotation.coeffs().data());
+        m_problem->SetParameterBlockConstant(first.translation.data());
+    }
+
+    // parameters start from where the last solve left them
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, m_problem.get(), &summary);
+
+    if (unanchored) {
+        m_problem->SetParameterBlockVariable(first.rotation.coeffs().data());
+        m_problem->SetParameterBlockVariable(first.translation.data());
+    }
+
+    return summary.IsSolutionUsable();
+}
+
+void CeresMap::update_problem(index_t first_keyframe) {
+    index_t keyframe_count = (index_t)m_keyframes.size();
+
+    if (!m_problem || first_keyframe < m_window_begin) {
+        ceres::Problem::Options options;
+        options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.enable_fast_removal = true;
+        m_problem = std::make_unique<ceres::Problem>(options);
+        for (auto &pose : m_keyframes) {
+            pose.state = Pose::OUTSIDE;
+            pose.residuals = 0;
+        }
+        m_landmark_active.assign(m_landmarks.size(), false);
+        m_window_begin = first_keyframe;
+        m_anchors = 0;
+
+        for (index_t i = first_keyframe; i < keyframe_count; ++i) {
+            if (m_keyframes[i].state == Pose::OUTSIDE) {
+                add_pose_block(i);
+            }
+            for (auto &ob : m_keyframes[i].observations) {
+                if (!m_landmark_active[ob.first]) {
+                    activate_landmark(ob.first);
+                }
+            }
+        }
+        return;
+    }
+
+    // keyframes leaving the window anchor it while their landmarks are still seen from inside
+    index_t window_begin = m_window_begin;
+    m_window_begin = first_keyframe;
+    for (index_t i = window_begin; i < first_keyframe; ++i) {
+        Pose &pose = m_keyframes[i];
+        pose.state = Pose::ANCHOR;
+        m_problem->SetParameterBlockConstant(pose.rotation.coeffs().data());
+        m_problem->SetParameterBlockConstant(pose.translation.data());
+        ++m_anchors;
+    }
+    for (index_t i = window_begin; i < first_keyframe; ++i) {
+        for (auto &ob : m_keyframes[i].observations) {
+            if (!m_landmark_active[ob.first]) {
+                continue;
+            }
+            const auto &observers = m_observers[ob.first];
+            if (std::none_of(observers.begin(), observers.end(), [&](index_t j) { return j >= first_keyframe; })) {
+                deactivate_landmark(ob.first);
+            }
+        }
+        if (m_keyframes[i].state == Pose::ANCHOR && m_keyframes[i].residuals == 0) {
+            remove_pose_block(i);
+        }
+    }
+}
+
+void CeresMap::add_pose_block(index_t keyframe) {
+    Pose &pose = m_keyframes[keyframe];
+    m_problem->AddParameterBlock(pose.rotation.coeffs().data(), 4, m_quaternion.get());
+    m_problem->AddParameterBlock(pose.translation.data(), 3);
+    if (keyframe < m_window_begin) {
+        pose.state = Pose::ANCHOR;
+        m_problem->SetParameterBlockConstant(pose.rotation.coeffs().data());
+        m_problem->SetParameterBlockConstant(pose.translation.data());
+        ++m_anchors;
+    }
+    else {
+        pose.state = Pose::WINDOW;
+        // the first two keyframes fix the scale of the map
+        if (keyframe < 2) {
+            m_problem->SetParameterBlockConstant(pose.translation.data());
+        }
+    }
+}
+
+void CeresMap::remove_pose_block(index_t keyframe) {
+    Pose &pose = m_keyframes[keyframe];
+    m_problem->RemoveParameterBlock(pose.rotation.coeffs().data());
+    m_problem->RemoveParameterBlock(pose.translation.data());
+    if (pose.state == Pose::ANCHOR) {
+        --m_anchors;
+    }
+    pose.state = Pose::OUTSIDE;
+    pose.residuals = 0;
+}
+
+void CeresMap::add_residual(index_t keyframe, index_t landmark) {
+    Pose &pose = m_keyframes[keyframe];
+    ceres::CostFunction *r = new ReprojectionCost(pose.observations.at(landmark));
+    m_problem->AddResidualBlock(r, m_loss.get(), m_landmarks[landmark].data(), pose.rotation.coeffs().data(), pose.translation.data());
+    ++pose.residuals;
+}
+
+void CeresMap::activate_landmark(index_t landmark) {
+    m_problem->AddParameterBlock(m_landmarks[landmark].data(), 3);
+    m_landmark_active[landmark] = true;
+    for (index_t i : m_observers[landmark]) {
+        if (m_keyframes[i].state == Pose::OUTSIDE) {
+            add_pose_block(i);
+        }
+        add_residual(i, landmark);
+    }
+}
+
+void CeresMap::deactivate_landmark(index_t landmark) {
+    // takes the residuals along
+    m_problem->RemoveParameterBlock(m_landmarks[landmark].data());
+    m_landmark_active[landmark] = false;
+    for (index_t i : m_observers[landmark]) {
+        Pose &pose = m_keyframes[i];
+        if (--pose.residuals == 0 && pose.state == Pose::ANCHOR) {
+            remove_pose_block(i);
+        }
+    }
+}
+
+real CeresMap::baseline(const mat3 &R, const vec3 &T) const {
+    vec3 p1 = -m_reference->R.transpose()*m_reference->T;
+    vec3 p2 = -R.transpose()*T;
+    return (p1 - p2).norm();
+}
+
 void CeresMap::send_visualization()
 {
     udp::socket socket;
@@ -1,14 +1,37 @@
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include "Map.h"
+#include "SpscQueue.h"
 
 namespace slam {
 
     class Config;
     class FourPointPnPRANSAC;
+    class ThreadPool;
     class Triangulator;
+    class Vocabulary;
+    class KeyframeDatabase;
+}
 
+namespace ceres {
+    class Problem;
+    class LossFunction;
+    class LocalParameterization;
+}
+
+namespace slam {
+
+    /*
+    Tracking and mapping run on separate threads. localize returns the PnP pose of a frame right away
+    and hands a new keyframe to the mapping thread, which adds it, runs bundle adjustment and triangulates
+    new landmarks. Tracking reads the map only through the snapshot published after each keyframe.
+    One keyframe is mapped at a time, frames arriving meanwhile are tracked against the last snapshot.
+    clear, init, relocalize and optimize wait for the mapping thread to finish its keyframe.
+    */
     class CeresMap : public Map {
     public:
         CeresMap(const Config *config);
@@ -16,33 +39,139 @@ namespace slam {
 
         void clear() override;
 
-        size_t add_keyframe(const std::shared_ptr<Frame> &pframe) override;
-        size_t add_landmark(const vec3 &point) override;
+        index_t add_keyframe(const std::shared_ptr<Frame> &pframe) override;
+        index_t add_landmark(const vec3 &point) override;
 
-        void add_observation(size_t keyframe, size_t landmark, const vec2 &x) override;
+        void add_observation(index_t keyframe, index_t landmark, const vec2 &x) override;
 
         bool init(const std::shared_ptr<Frame> &current_frame, const Initializer *initializer) override;
 
         bool localize(const std::shared_ptr<Frame> &pframe) override;
 
+        bool localize_tracks(const KeypointArray &points, match_vector &tracks, mat3 &R, vec3 &T) override;
+
+        bool relocalize(const std::shared_ptr<Frame> &pframe) override;
+
+        bool optimize() override;
+
+        void set_time_budget(double seconds) override;
+
     private:
+        // Keyframe tracking matches new frames against.
+        struct Reference {
+            std::shared_ptr<Frame> keyframe; // only its feature is read
+            index_t keyframe_id;
+            mat3 R;
+            vec3 T;
+            std::vector<index_t> landmark_map;
+        };
+
+        // Map as tracking sees it, version counts the keyframe requests mapped.
+        struct Snapshot {
+            size_t version;
+            std::vector<vec3d> landmarks;
+            std::shared_ptr<const Reference> reference;
+        };
+
+        // A keyframe localized by tracking, for the mapping thread.
+        struct KeyframeRequest {
+            std::shared_ptr<Frame> frame;
+            index_t reference;           // keyframe id the matches refer to
+            match_vector pnp_matches;    // landmark id, keypoint
+            match_vector image_matches;  // unmapped reference keypoint, keypoint
+        };
+
         void send_visualization();
 
+        // Distance between the camera center of pose R, T and that of the reference keyframe.
+        real baseline(const mat3 &R, const vec3 &T) const;
+
+        // Tracking side: pick up the newest snapshot and its reference keyframe.
+        void acquire_snapshot();
+
+        // Tracking side: block until the mapping thread has no keyframe left.
+        void wait_mapping();
+
+        std::shared_ptr<const Reference> make_reference(index_t keyframe) const;
+        void publish(index_t reference);
+
+        // Body of the mapping thread.
+        void map_keyframes();
+
+        // Add a keyframe to the map, adjust the local window and triangulate against the reference.
+        void map_keyframe(const KeyframeRequest &request);
+
+        /*
+        Bundle adjustment of keyframes from first_keyframe on and the landmarks they observe.
+        Older keyframes observing those landmarks take part with fixed poses.
+        */
+        bool bundle_adjust(index_t first_keyframe);
+
+        /*
+        The problem is kept between solves and follows the map: keyframes, landmarks and observations
+        are added as they come, and moving the window forward only fixes the keyframes that leave it and
+        drops the landmarks none of the window sees anymore. It is rebuilt when the window moves back
+        or when growing m_keyframes or m_landmarks moves the parameter blocks.
+        */
+        void update_problem(index_t first_keyframe);
+        void add_pose_block(index_t keyframe);
+        void remove_pose_block(index_t keyframe);
+        void add_residual(index_t keyframe, index_t landmark);
+        void activate_landmark(index_t landmark);
+        void deactivate_landmark(index_t landmark);
+
         struct Pose {
+            enum State { OUTSIDE, ANCHOR, WINDOW };
+
             quatd rotation;
             vec3d translation;
-            std::unordered_map<size_t, vec2d> observations;
+            std::unordered_map<index_t, vec2d> observations;
+            std::shared_ptr<Frame> frame;
+            std::vector<index_t> landmark_map; // landmark id of each keypoint of frame
+
+            State state = OUTSIDE;  // part the pose takes in the problem
+            size_t residuals = 0;   // observations in the problem
         };
 
         mat3d m_K;
 
         std::vector<Pose> m_keyframes;
         std::vector<vec3d> m_landmarks;
+        std::vector<std::vector<index_t>> m_observers; // keyframes observing each landmark
 
-        std::shared_ptr<Frame> m_last_keyframe;
 
+        std::unique_ptr<ThreadPool> m_ransac_pool;
         std::unique_ptr<FourPointPnPRANSAC> m_pnp;
         std::unique_ptr<Triangulator> m_triangulator;
+
+        std::unique_ptr<Vocabulary> m_vocabulary;
+        std::unique_ptr<KeyframeDatabase> m_database;
+        size_t m_relocalization_candidates;
+        size_t m_relocalization_min_inliers;
+        size_t m_local_window; // keyframes adjusted with each new one, 0 for all
+
+        std::unique_ptr<ceres::LossFunction> m_loss;
+        std::unique_ptr<ceres::LocalParameterization> m_quaternion;
+        std::unique_ptr<ceres::Problem> m_problem; // null until the next solve rebuilds it
+        std::vector<bool> m_landmark_active; // landmark is a parameter block of m_problem
+        index_t m_window_begin = 0;
+        size_t m_anchors = 0;
+
+        // tracking side
+        std::shared_ptr<const Snapshot> m_tracking_snapshot;
+        std::shared_ptr<const Reference> m_reference;
+        size_t m_requested = 0; // keyframe requests handed to mapping
+
+        // between the threads
+        std::shared_ptr<const Snapshot> m_snapshot; // accessed with std::atomic_load and std::atomic_store
+        SpscQueue<KeyframeRequest> m_requests;
+        std::mutex m_mapping_mutex; // only for sleeping and waking, the queue itself needs no lock
+        std::condition_variable m_mapping_condition;
+        bool m_stop = false;
+
+        // mapping side, and tracking side while the mapping thread is idle
+        size_t m_mapped = 0;
+        std::thread m_mapping_thread; // not started when Map.mappingThread is 0, tracking maps then
     };
 
 }
\ No newline at end of file
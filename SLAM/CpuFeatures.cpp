@@ -0,0 +1,69 @@
+#include <cstdint>
+#include "CpuFeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SLAM_CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace slam;
+
+namespace {
+
+#ifdef SLAM_CPU_X86
+
+    void cpuid(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+        __cpuidex(info, leaf, subleaf);
+#else
+        unsigned int a, b, c, d;
+        __cpuid_count(leaf, subleaf, a, b, c, d);
+        info[0] = (int)a; info[1] = (int)b; info[2] = (int)c; info[3] = (int)d;
+#endif
+    }
+
+    // XCR0: which register states the OS saves on context switch.
+    std::uint64_t xgetbv0() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((std::uint64_t)edx << 32) | eax;
+#endif
+    }
+
+#endif
+
+    CpuFeatures detect() {
+        CpuFeatures features = { false, false, false };
+#ifdef SLAM_CPU_X86
+        int info[4];
+        cpuid(info, 0, 0);
+        int max_leaf = info[0];
+
+        cpuid(info, 1, 0);
+        features.sse42 = (info[2] & (1 << 20)) != 0;
+        features.popcnt = (info[2] & (1 << 23)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+
+        if (max_leaf >= 7 && osxsave && avx && (xgetbv0() & 0x6) == 0x6) {
+            cpuid(info, 7, 0);
+            features.avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#endif
+        return features;
+    }
+
+}
+
+const CpuFeatures &slam::cpu_features() {
+    static const CpuFeatures features = detect();
+    return features;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+namespace slam {
+
+    // Instruction set extensions the CPU and the OS both support, detected once.
+    struct CpuFeatures {
+        bool sse42;
+        bool popcnt;
+        bool avx2;
+    };
+
+    const CpuFeatures &cpu_features();
+
+}
+
+// MSVC accepts any intrinsic in any function, gcc/clang need the target enabled per function.
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+#define SLAM_TARGET_AVX2 __attribute__((target("avx2")))
+#define SLAM_TARGET_POPCNT __attribute__((target("popcnt,sse4.2")))
+#else
+#define SLAM_TARGET_AVX2
+#define SLAM_TARGET_POPCNT
+#endif
@@ -0,0 +1,130 @@
+#include "EssentialRANSAC.h"
+#include "Config.h"
+#include "EightPointEssentialRANSAC.h"
+#include "FivePointEssentialRANSAC.h"
+#include "Geometry.h"
+
+using namespace slam;
+
+EssentialRANSAC::EssentialRANSAC(const mat3 & K, real sigma)
+    : E(mat3::Zero()), m_sigma(sigma), K(K)
+{}
+
+EssentialRANSAC::~EssentialRANSAC() = default;
+
+std::unique_ptr<EssentialRANSAC> EssentialRANSAC::create(const Config *config, ThreadPool *pool) {
+    real sigma = (real)config->value("RANSAC.Essential.sigma", config->value("RANSAC.sigma", 1.0));
+    real success_rate = (real)config->value("RANSAC.Essential.successRate", config->value("RANSAC.successRate", 0.99));
+    size_t max_iter = (size_t)config->value("RANSAC.Essential.maxIteration", config->value("RANSAC.maxIteration", 10000000));
+    unsigned int seed = (unsigned int)config->value("RANSAC.seed", 0);
+    size_t lo_iterations = (size_t)config->value("RANSAC.localOptimization", 0);
+
+    std::unique_ptr<EssentialRANSAC> result;
+    RANSACBase *ransac;
+    if (config->text("Initializer.essentialSolver", "eight") == "five") {
+        auto five_point = std::make_unique<FivePointEssentialRANSAC>(config->K, sigma, success_rate, max_iter);
+        ransac = five_point.get();
+        result = std::move(five_point);
+    }
+    else {
+        auto eight_point = std::make_unique<EightPointEssentialRANSAC>(config->K, sigma, success_rate, max_iter);
+        ransac = eight_point.get();
+        result = std::move(eight_point);
+    }
+    ransac->set_thread_pool(pool);
+    ransac->set_seed(seed);
+    ransac->set_local_optimization(lo_iterations);
+    return result;
+}
+
+void EssentialRANSAC::set_dataset(const KeypointArray& pa, const KeypointArray& pb, const match_vector & matches) {
+    m_ppa = &pa;
+    m_ppb = &pb;
+    m_pmatches = &matches;
+
+    m_pairs.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i) {
+        m_pairs.ax[i] = pa.x[matches[i].first];
+        m_pairs.ay[i] = pa.y[matches[i].first];
+        m_pairs.bx[i] = pb.x[matches[i].second];
+        m_pairs.by[i] = pb.y[matches[i].second];
+    }
+    m_score_params = ScoreParams{ K(0, 0), K(1, 1), 1.0f / (m_sigma*m_sigma) };
+}
+
+size_t EssentialRANSAC::data_size() const {
+    if (m_pmatches) {
+        return m_pmatches->size();
+    }
+    else {
+        return 0;
+    }
+}
+
+void EssentialRANSAC::reset_model() {
+    E = mat3::Zero();
+    matches.clear();
+}
+
+void EssentialRANSAC::reset_slots(size_t count) {
+    m_slots.resize(count);
+}
+
+size_t EssentialRANSAC::fit_local(size_t slot, const std::vector<size_t> &sample_set) {
+    if (sample_set.size() < linear_sample_size) {
+        return 0;
+    }
+    Slot &s = m_slots[slot];
+    s.la.resize(sample_set.size());
+    s.lb.resize(sample_set.size());
+    for (size_t i = 0; i < sample_set.size(); ++i) {
+        s.la[i] = vec2(m_pairs.ax[sample_set[i]], m_pairs.ay[sample_set[i]]);
+        s.lb[i] = vec2(m_pairs.bx[sample_set[i]], m_pairs.by[sample_set[i]]);
+    }
+
+    s.E[0] = fix_essential(solve_essential(s.la, s.lb));
+    return 1;
+}
+
+real EssentialRANSAC::eval_block(size_t slot, size_t model, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask) {
+    return score_essential(m_slots[slot].E[model], m_pairs, begin, end, m_score_params.widened(threshold_scale), mask);
+}
+
+void EssentialRANSAC::keep_model(size_t slot, size_t model) {
+    m_slots[slot].best_E = m_slots[slot].E[model];
+}
+
+void EssentialRANSAC::use_model(size_t slot) {
+    E = m_slots[slot].best_E;
+}
+
+void EssentialRANSAC::refine_model(const InlierMask &inlier_set) {
+    const KeypointArray &pa = *m_ppa;
+    const KeypointArray &pb = *m_ppb;
+    const match_vector &old_matches = *m_pmatches;
+
+    matches.clear();
+    matches.reserve(old_matches.size());
+    for (size_t i = 0; i < old_matches.size(); ++i) {
+        if (inlier_set[i]) {
+            matches.push_back(old_matches[i]);
+        }
+    }
+    matches.shrink_to_fit();
+
+    // below that keep the model of the sample
+    if (matches.size() < linear_sample_size) {
+        return;
+    }
+
+    std::vector<vec2> a, b;
+    a.resize(matches.size());
+    b.resize(matches.size());
+
+    for (size_t i = 0; i < matches.size(); ++i) {
+        a[i] = pa[matches[i].first];
+        b[i] = pb[matches[i].second];
+    }
+
+    E = fix_essential(solve_essential(a, b));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include "RANSAC.h"
+#include "ScoreKernels.h"
+
+namespace slam {
+
+    class Config;
+
+    /*
+    Essential matrix between two views, common to the minimal solvers: the dataset, scoring by the
+    symmetric epipolar distance and the final eight-point refinement on all inliers. A solver derives
+    from RANSAC<Solver, N> and this, and provides fit_model and estimate.
+    */
+    class EssentialRANSAC {
+    public:
+        mat3 E;
+        match_vector matches;
+
+        virtual ~EssentialRANSAC();
+
+        void set_dataset(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches);
+
+        // Run on all matches, weighted by their quality, and return the score of E.
+        virtual real estimate(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches, const std::vector<real> &quality) = 0;
+
+        /*
+        Solver named by Initializer.essentialSolver: "eight" (default) or "five", configured by
+        RANSAC.Essential.* over RANSAC.*, hypotheses spread over pool.
+        */
+        static std::unique_ptr<EssentialRANSAC> create(const Config *config, ThreadPool *pool);
+
+    protected:
+        EssentialRANSAC(const mat3 &K, real sigma);
+
+        // Hooks of RANSAC, see there. Model k of a slot is E[k].
+        size_t data_size() const;
+
+        void reset_model();
+
+        void reset_slots(size_t count);
+
+        size_t fit_local(size_t slot, const std::vector<size_t> &sample_set);
+
+        real eval_block(size_t slot, size_t model, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask);
+
+        void keep_model(size_t slot, size_t model);
+
+        void use_model(size_t slot);
+
+        void refine_model(const InlierMask &inlier_set);
+
+        // Fewest matches of the linear solver.
+        static const size_t linear_sample_size = 8;
+
+        const KeypointArray *m_ppa = nullptr;
+        const KeypointArray *m_ppb = nullptr;
+        const match_vector *m_pmatches = nullptr;
+
+        PairArray m_pairs; // matched points, gathered by set_dataset
+        ScoreParams m_score_params;
+
+        real m_sigma;
+        mat3 K;
+
+        struct Slot {
+            std::array<mat3, 10> E; // a five point sample gives up to ten
+            mat3 best_E;
+            std::vector<vec2> la, lb; // of local optimization
+        };
+        std::vector<Slot> m_slots;
+    };
+
+}
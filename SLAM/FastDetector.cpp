@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <climits>
+#include "FastDetector.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SLAM_FAST_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace slam;
+
+// Bresenham circle of radius 3, clockwise from the top.
+static const int circle_dx[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int circle_dy[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+/*
+Largest difference d such that 9 contiguous circle pixels are all brighter than
+center + d or all darker than center - d. The pixel is a corner iff score > threshold.
+*/
+static int corner_score(const std::uint8_t *p, const int *circle) {
+    int v = p[0];
+    int d[16];
+    for (int k = 0; k < 16; ++k) {
+        d[k] = v - p[circle[k]];
+    }
+
+    int best = 0;
+    for (int k = 0; k < 16; ++k) {
+        int darker = INT_MAX, brighter = INT_MAX;
+        for (int j = 0; j < 9; ++j) {
+            int e = d[(k + j) & 15];
+            darker = std::min(darker, e);
+            brighter = std::min(brighter, -e);
+        }
+        best = std::max(best, std::max(darker, brighter));
+    }
+    return best;
+}
+
+#ifdef SLAM_FAST_SSE2
+/*
+Segment test for the 16 pixels starting at p, bit i set if p + i is a corner.
+Comparisons run on bytes biased by 0x80 so that signed compares order them as unsigned.
+*/
+static int fast9_mask16(const std::uint8_t *p, const int *circle, __m128i t) {
+    const __m128i delta = _mm_set1_epi8((char)0x80);
+    const __m128i eight = _mm_set1_epi8(8);
+
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hi = _mm_xor_si128(_mm_adds_epu8(v, t), delta);
+    __m128i lo = _mm_xor_si128(_mm_subs_epu8(v, t), delta);
+
+    // every 9-pixel arc covers two neighbouring compass points, reject on those first
+    __m128i brighter[4], darker[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + circle[4 * i])), delta);
+        brighter[i] = _mm_cmpgt_epi8(x, hi);
+        darker[i] = _mm_cmpgt_epi8(lo, x);
+    }
+    __m128i any = _mm_setzero_si128();
+    for (int i = 0; i < 4; ++i) {
+        any = _mm_or_si128(any, _mm_and_si128(brighter[i], brighter[(i + 1) & 3]));
+        any = _mm_or_si128(any, _mm_and_si128(darker[i], darker[(i + 1) & 3]));
+    }
+    if (_mm_movemask_epi8(any) == 0) {
+        return 0;
+    }
+
+    // longest run of brighter / darker pixels, going round the circle once plus 8
+    __m128i run_b = _mm_setzero_si128(), run_d = _mm_setzero_si128();
+    __m128i max_b = _mm_setzero_si128(), max_d = _mm_setzero_si128();
+    for (int k = 0; k < 25; ++k) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + circle[k & 15])), delta);
+        __m128i mb = _mm_cmpgt_epi8(x, hi);
+        __m128i md = _mm_cmpgt_epi8(lo, x);
+        run_b = _mm_and_si128(_mm_sub_epi8(run_b, mb), mb);
+        run_d = _mm_and_si128(_mm_sub_epi8(run_d, md), md);
+        max_b = _mm_max_epu8(max_b, run_b);
+        max_d = _mm_max_epu8(max_d, run_d);
+    }
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_max_epu8(max_b, max_d), eight));
+}
+#endif
+
+void slam::fast9_detect(const std::uint8_t *image, size_t stride, int width, int height, int x0, int y0, int x1, int y1, int threshold, std::vector<Corner> &corners) {
+    threshold = std::min(std::max(threshold, 0), 254);
+
+    // corners are tested one pixel beyond the rect so that suppression sees its neighbours
+    int cx0 = std::max(x0, 3), cy0 = std::max(y0, 3);
+    int cx1 = std::min(x1, width - 3), cy1 = std::min(y1, height - 3);
+    if (cx0 >= cx1 || cy0 >= cy1) {
+        return;
+    }
+    int ex0 = std::max(cx0 - 1, 3), ey0 = std::max(cy0 - 1, 3);
+    int ex1 = std::min(cx1 + 1, width - 3), ey1 = std::min(cy1 + 1, height - 3);
+
+    int circle[16];
+    for (int k = 0; k < 16; ++k) {
+        circle[k] = circle_dy[k] * (int)stride + circle_dx[k];
+    }
+
+    // scores with a zero border of one pixel, 0 means no corner
+    int map_x0 = ex0 - 1, map_y0 = ey0 - 1;
+    int map_cols = ex1 - ex0 + 2, map_rows = ey1 - ey0 + 2;
+    std::vector<int> scores((size_t)map_cols*map_rows, 0);
+
+    for (int y = ey0; y < ey1; ++y) {
+        const std::uint8_t *row = image + (size_t)y*stride;
+        int *score_row = scores.data() + (size_t)(y - map_y0)*map_cols;
+        int x = ex0;
+#ifdef SLAM_FAST_SSE2
+        if (ex1 - ex0 >= 16) {
+            const __m128i t = _mm_set1_epi8((char)threshold);
+            for (;;) {
+                // the last block is shifted back to end at ex1, overlapping pixels get the same score
+                int bx = std::min(x, ex1 - 16);
+                int mask = fast9_mask16(row + bx, circle, t);
+                while (mask) {
+                    int i = 0;
+                    while (((mask >> i) & 1) == 0) {
+                        ++i;
+                    }
+                    mask &= mask - 1;
+                    int score = corner_score(row + bx + i, circle);
+                    score_row[bx + i - map_x0] = score > threshold ? score : 0;
+                }
+                if (bx + 16 >= ex1) {
+                    break;
+                }
+                x = bx + 16;
+            }
+            x = ex1;
+        }
+#endif
+        for (; x < ex1; ++x) {
+            int score = corner_score(row + x, circle);
+            score_row[x - map_x0] = score > threshold ? score : 0;
+        }
+    }
+
+    for (int y = cy0; y < cy1; ++y) {
+        const int *prev = scores.data() + (size_t)(y - 1 - map_y0)*map_cols;
+        const int *curr = prev + map_cols;
+        const int *next = curr + map_cols;
+        for (int x = cx0; x < cx1; ++x) {
+            int m = x - map_x0;
+            int s = curr[m];
+            if (s == 0) {
+                continue;
+            }
+            if (s > prev[m - 1] && s > prev[m] && s > prev[m + 1] &&
+                s > curr[m - 1] && s > curr[m + 1] &&
+                s > next[m - 1] && s > next[m] && s > next[m + 1]) {
+                corners.push_back(Corner{ (float)x, (float)y, (float)s });
+            }
+        }
+    }
+}
+
+TiledFastDetector::TiledFastDetector(ThreadPool *pool, int spread_size, int tile_cells, int threshold, int min_threshold, int max_threshold) {
+    m_pool = pool;
+    m_spread_size = std::max(spread_size, 1);
+    m_tile_cells = std::max(tile_cells, 1);
+    m_threshold = threshold;
+    m_min_threshold = std::min(min_threshold, threshold);
+    m_max_threshold = std::max(max_threshold, threshold);
+    m_tile_cols = 0;
+    m_tile_rows = 0;
+}
+
+TiledFastDetector::~TiledFastDetector() = default;
+
+/*
+Tiles are aligned to cells, so each tile writes only its own slots of the flat cell array.
+*/
+void TiledFastDetector::detect(int width, int height, const Backend &backend, std::vector<Corner> &corners) {
+    const int spread_size = m_spread_size;
+    int grid_cols = (width + spread_size - 1) / spread_size;
+    int grid_rows = (height + spread_size - 1) / spread_size;
+    int tile_size = spread_size * m_tile_cells;
+    int tile_cols = (width + tile_size - 1) / tile_size;
+    int tile_rows = (height + tile_size - 1) / tile_size;
+
+    if (tile_cols != m_tile_cols || tile_rows != m_tile_rows) {
+        m_tile_cols = tile_cols;
+        m_tile_rows = tile_rows;
+        m_tile_thresholds.assign((size_t)tile_cols*tile_rows, m_threshold);
+    }
+
+    // response < 0 marks an empty cell
+    std::vector<Corner> cells((size_t)grid_cols*grid_rows, Corner{ 0.0f, 0.0f, -1.0f });
+
+    m_pool->parallel_for((size_t)tile_cols*tile_rows, [&](size_t tile) {
+        int x0 = (int)(tile % tile_cols) * tile_size;
+        int y0 = (int)(tile / tile_cols) * tile_size;
+        int x1 = std::min(x0 + tile_size, width);
+        int y1 = std::min(y0 + tile_size, height);
+
+        size_t target = (size_t)((x1 - x0 + spread_size - 1) / spread_size) * ((y1 - y0 + spread_size - 1) / spread_size);
+        int &threshold = m_tile_thresholds[tile];
+
+        // lower the threshold until the tile has about one corner per cell
+        std::vector<Corner> detected;
+        for (;;) {
+            detected.clear();
+            backend(x0, y0, x1, y1, threshold, detected);
+            if (detected.size() >= target || threshold <= m_min_threshold) {
+                break;
+            }
+            threshold = std::max(m_min_threshold, threshold * 2 / 3);
+        }
+
+        // and raise it for the next frame when the tile is flooded
+        if (detected.size() > 4 * target) {
+            threshold = std::min(m_max_threshold, threshold + threshold / 4 + 1);
+        }
+
+        for (auto &corner : detected) {
+            Corner &cell = cells[(size_t)((int)corner.y / spread_size)*grid_cols + (int)corner.x / spread_size];
+            if (cell.response < corner.response) {
+                cell = corner;
+            }
+        }
+    });
+
+    corners.clear();
+    for (auto &cell : cells) {
+        if (cell.response >= 0) {
+            corners.push_back(cell);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace slam {
+
+    class ThreadPool;
+
+    // Corner in pixel coordinates.
+    struct Corner {
+        float x;
+        float y;
+        float response;
+    };
+
+    /*
+    FAST-9 segment test (9 contiguous pixels of the 16-pixel circle all brighter or all
+    darker than center by threshold) with 3x3 non-maximum suppression on the corner score.
+    Reports corners centered in [x0, x1) x [y0, y1) of an 8-bit width x height image;
+    pixels outside that rect are read for the test. SSE2 when available.
+    */
+    void fast9_detect(const std::uint8_t *image, size_t stride, int width, int height, int x0, int y0, int x1, int y1, int threshold, std::vector<Corner> &corners);
+
+    /*
+    Runs a FAST backend over image tiles on a thread pool and keeps the strongest corner
+    of every spread_size x spread_size cell. Tiles span tile_cells x tile_cells cells and
+    each keeps its own threshold across frames: lowered within a frame until the tile has
+    about one corner per cell, raised for the next frame when the tile is flooded.
+    */
+    class TiledFastDetector {
+    public:
+        // backend(x0, y0, x1, y1, threshold, corners): append corners centered in the rect
+        typedef std::function<void(int, int, int, int, int, std::vector<Corner> &)> Backend;
+
+        TiledFastDetector(ThreadPool *pool, int spread_size, int tile_cells, int threshold, int min_threshold, int max_threshold);
+        ~TiledFastDetector();
+
+        // Corners of a width x height image, at most one per cell, in row-major cell order.
+        void detect(int width, int height, const Backend &backend, std::vector<Corner> &corners);
+
+    private:
+        ThreadPool *m_pool;
+        int m_spread_size;
+        int m_tile_cells;
+        int m_threshold;
+        int m_min_threshold;
+        int m_max_threshold;
+
+        int m_tile_cols;
+        int m_tile_rows;
+        std::vector<int> m_tile_thresholds;
+    };
+
+}
@@ -0,0 +1,13 @@
+#include "Config.h"
+#include "Feature.h"
+#include "OcvOrbFeature.h"
+#include "NativeOrbFeatureExtractor.h"
+
+using namespace slam;
+
+std::unique_ptr<FeatureExtractor> FeatureExtractor::create(const Config *config) {
+    if (config->text("Feature.type", "ocv") == "native") {
+        return std::make_unique<NativeOrbFeatureExtractor>(config);
+    }
+    return std::make_unique<OcvOrbFeatureExtractor>(config);
+}
@@ -3,18 +3,29 @@
 #include <vector>
 #include <memory>
 #include "Types.h"
+#include "Hamming.h"
 
 namespace slam {
 
     class Image;
+    class Config;
 
     class Feature {
     public:
         virtual ~Feature() {}
 
-        virtual match_vector match(const Feature *feature, size_t k = 5, real radius = 1.0e7f) const = 0;
+        /*
+        Match every keypoint of this feature to its most similar keypoint of feature
+        that lies within radius. If predictions is given, predictions[i] replaces
+        keypoints[i] as the search center in the target; non-finite predictions are skipped.
+        If quality is given it receives a score in [0, 1] per match, higher is more distinctive.
+        */
+        virtual match_vector match(const Feature *feature, real radius = 1.0e7f, const KeypointArray *predictions = nullptr, std::vector<real> *quality = nullptr) const = 0;
 
-        std::vector<vec2> keypoints;
+        // Binary descriptors of the keypoints, nullptr if this feature type has none.
+        virtual const DescriptorArray *descriptors() const { return nullptr; }
+
+        KeypointArray keypoints;
         
     };
 
@@ -24,6 +35,9 @@ namespace slam {
 
         virtual std::unique_ptr<Feature> extract(const Image *image) const = 0;
 
+        // Extractor named by Feature.type: "ocv" (cv::ORB, default) or "native".
+        static std::unique_ptr<FeatureExtractor> create(const Config *config);
+
     };
 
 }
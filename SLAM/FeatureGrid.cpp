@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include "FeatureGrid.h"
+
+using namespace slam;
+
+FeatureGrid::FeatureGrid()
+    : m_origin(vec2::Zero()), m_inv_cell_size(1.0f), m_cols(0), m_rows(0)
+{}
+
+FeatureGrid::~FeatureGrid() = default;
+
+void FeatureGrid::build(const KeypointArray &points, real cell_size) {
+    m_cell_begin.clear();
+    m_indices.clear();
+    m_points.resize(0);
+    m_cols = m_rows = 0;
+
+    if (points.empty()) {
+        return;
+    }
+
+    vec2 lower(*std::min_element(points.x.begin(), points.x.end()), *std::min_element(points.y.begin(), points.y.end()));
+    vec2 upper(*std::max_element(points.x.begin(), points.x.end()), *std::max_element(points.y.begin(), points.y.end()));
+
+    m_origin = lower;
+    m_inv_cell_size = 1.0f / cell_size;
+    m_cols = (int)((upper.x() - lower.x()) * m_inv_cell_size) + 1;
+    m_rows = (int)((upper.y() - lower.y()) * m_inv_cell_size) + 1;
+
+    // counting sort of points into cells
+    std::vector<size_t> cell_of(points.size());
+    m_cell_begin.assign((size_t)m_cols*m_rows + 1, 0);
+    for (size_t i = 0; i < points.size(); ++i) {
+        cell_of[i] = (size_t)cell_y(points.y[i])*m_cols + cell_x(points.x[i]);
+        m_cell_begin[cell_of[i] + 1]++;
+    }
+    for (size_t c = 1; c < m_cell_begin.size(); ++c) {
+        m_cell_begin[c] += m_cell_begin[c - 1];
+    }
+
+    std::vector<size_t> cursor(m_cell_begin.begin(), m_cell_begin.end() - 1);
+    m_indices.resize(points.size());
+    m_points.resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        size_t slot = cursor[cell_of[i]]++;
+        m_indices[slot] = i;
+        m_points.x[slot] = points.x[i];
+        m_points.y[slot] = points.y[i];
+    }
+}
+
+void FeatureGrid::query(const vec2 &center, real radius, std::vector<size_t> &indices) const {
+    if (empty() || !center.allFinite()) {
+        return;
+    }
+
+    int x0 = cell_x(center.x() - radius);
+    int x1 = cell_x(center.x() + radius);
+    int y0 = cell_y(center.y() - radius);
+    int y1 = cell_y(center.y() + radius);
+
+    real radius2 = radius*radius;
+
+    for (int y = y0; y <= y1; ++y) {
+        size_t row = (size_t)y*m_cols;
+        // cells of one grid row are contiguous, so scan them as a single span
+        size_t begin = m_cell_begin[row + x0];
+        size_t end = m_cell_begin[row + x1 + 1];
+        for (size_t k = begin; k < end; ++k) {
+            real dx = m_points.x[k] - center.x();
+            real dy = m_points.y[k] - center.y();
+            if (dx*dx + dy*dy < radius2) {
+                indices.push_back(m_indices[k]);
+            }
+        }
+    }
+}
+
+bool FeatureGrid::empty() const {
+    return m_indices.empty();
+}
+
+int FeatureGrid::cell_x(real x) const {
+    real c = std::floor((x - m_origin.x()) * m_inv_cell_size);
+    return (int)std::min(std::max(c, 0.0f), (real)(m_cols - 1));
+}
+
+int FeatureGrid::cell_y(real y) const {
+    real c = std::floor((y - m_origin.y()) * m_inv_cell_size);
+    return (int)std::min(std::max(c, 0.0f), (real)(m_rows - 1));
+}
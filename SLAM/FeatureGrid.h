@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include "Types.h"
+
+namespace slam {
+
+    /*
+    Uniform bucket grid over keypoints, in the same normalized image coordinates
+    as Feature::keypoints. Points are stored cell by cell so that a radius query
+    only visits the cells overlapping the search circle.
+    */
+    class FeatureGrid {
+    public:
+        FeatureGrid();
+        ~FeatureGrid();
+
+        void build(const KeypointArray &points, real cell_size);
+
+        // Collect indices of all points within radius of center (appended to indices).
+        void query(const vec2 &center, real radius, std::vector<size_t> &indices) const;
+
+        bool empty() const;
+
+    private:
+        int cell_x(real x) const;
+        int cell_y(real y) const;
+
+        vec2 m_origin;
+        real m_inv_cell_size;
+        int m_cols;
+        int m_rows;
+
+        std::vector<size_t> m_cell_begin; // m_cols*m_rows+1 offsets into m_indices
+        std::vector<size_t> m_indices;    // point indices, sorted by cell
+        KeypointArray m_points;           // point positions, sorted by cell
+    };
+
+}
@@ -0,0 +1,171 @@
+#include <complex>
+#include "FivePointEssentialRANSAC.h"
+#include "Geometry.h"
+
+using namespace slam;
+
+namespace {
+
+    /*
+    Polynomials of degree 3 in x, y, z, coefficients in graded reverse lexicographic order:
+    x^3 x^2y xy^2 y^3 x^2z xyz y^2z xz^2 yz^2 z^3 | x^2 xy y^2 xz yz z^2 x y z 1.
+    The last ten monomials are the basis of the quotient ring of the five-point equations.
+    */
+    typedef Eigen::Matrix<double, 20, 1> poly3;
+
+    const int monomial_exponents[20][3] = {
+        { 3, 0, 0 }, { 2, 1, 0 }, { 1, 2, 0 }, { 0, 3, 0 }, { 2, 0, 1 },
+        { 1, 1, 1 }, { 0, 2, 1 }, { 1, 0, 2 }, { 0, 1, 2 }, { 0, 0, 3 },
+        { 2, 0, 0 }, { 1, 1, 0 }, { 0, 2, 0 }, { 1, 0, 1 }, { 0, 1, 1 },
+        { 0, 0, 2 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 0, 0 }
+    };
+
+    struct MonomialTable {
+        int index[4][4][4]; // of x^a y^b z^c, -1 above degree 3
+
+        MonomialTable() {
+            for (int a = 0; a < 4; ++a) for (int b = 0; b < 4; ++b) for (int c = 0; c < 4; ++c) {
+                index[a][b][c] = -1;
+            }
+            for (int i = 0; i < 20; ++i) {
+                index[monomial_exponents[i][0]][monomial_exponents[i][1]][monomial_exponents[i][2]] = i;
+            }
+        }
+    };
+
+    const MonomialTable monomials;
+
+    // Product of two polynomials whose degrees add up to at most 3.
+    poly3 multiply(const poly3 &p, const poly3 &q) {
+        poly3 r = poly3::Zero();
+        for (int i = 0; i < 20; ++i) {
+            if (p[i] == 0) continue;
+            for (int j = 0; j < 20; ++j) {
+                if (q[j] == 0) continue;
+                int a = monomial_exponents[i][0] + monomial_exponents[j][0];
+                int b = monomial_exponents[i][1] + monomial_exponents[j][1];
+                int c = monomial_exponents[i][2] + monomial_exponents[j][2];
+                if (a < 4 && b < 4 && c < 4 && monomials.index[a][b][c] >= 0) {
+                    r[monomials.index[a][b][c]] += p[i] * q[j];
+                }
+            }
+        }
+        return r;
+    }
+
+    // Leading monomials reduced to the basis, rows of the action matrix of x.
+    const int x_times_basis_row[6] = { 0, 1, 2, 4, 5, 7 }; // x^3 x^2y xy^2 x^2z xyz xz^2
+    // x times x, y, z, 1 lands on the basis monomials x^2, xy, xz, x.
+    const int x_times_basis_shift[4][2] = { { 6, 0 }, { 7, 1 }, { 8, 3 }, { 9, 6 } };
+
+}
+
+size_t slam::solve_essential_five_point(const vec2 *pa, const vec2 *pb, std::array<mat3, 10> &E) {
+    // epipolar constraints on the 9 entries of E, column major like Eigen's storage
+    Eigen::Matrix<double, 5, 9> Q;
+    for (int i = 0; i < 5; ++i) {
+        double ax = pa[i](0), ay = pa[i](1), bx = pb[i](0), by = pb[i](1);
+        Q.row(i) << ax*bx, ax*by, ax, ay*bx, ay*by, ay, bx, by, 1;
+    }
+
+    // E = x X + y Y + z Z + W over the null space of Q
+    Eigen::JacobiSVD<Eigen::Matrix<double, 5, 9>> svd(Q, Eigen::ComputeFullV);
+    const Eigen::Matrix<double, 9, 9> &V = svd.matrixV();
+
+    // entries of E as linear polynomials
+    poly3 e[3][3];
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            poly3 &p = e[r][c];
+            p.setZero();
+            p[16] = V(c * 3 + r, 5);
+            p[17] = V(c * 3 + r, 6);
+            p[18] = V(c * 3 + r, 7);
+            p[19] = V(c * 3 + r, 8);
+        }
+    }
+
+    // det(E) = 0 and 2 E E^T E - trace(E E^T) E = 0: ten cubics
+    Eigen::Matrix<double, 10, 20> A;
+    poly3 det = multiply(e[0][0], multiply(e[1][1], e[2][2]) - multiply(e[1][2], e[2][1]))
+        - multiply(e[0][1], multiply(e[1][0], e[2][2]) - multiply(e[1][2], e[2][0]))
+        + multiply(e[0][2], multiply(e[1][0], e[2][1]) - multiply(e[1][1], e[2][0]));
+    A.row(0) = det.transpose();
+
+    poly3 EEt[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = i; j < 3; ++j) {
+            EEt[i][j] = multiply(e[i][0], e[j][0]) + multiply(e[i][1], e[j][1]) + multiply(e[i][2], e[j][2]);
+            EEt[j][i] = EEt[i][j];
+        }
+    }
+    poly3 half_trace = 0.5 * (EEt[0][0] + EEt[1][1] + EEt[2][2]);
+    for (int i = 0; i < 3; ++i) {
+        EEt[i][i] -= half_trace;
+    }
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            poly3 p = multiply(EEt[i][0], e[0][j]) + multiply(EEt[i][1], e[1][j]) + multiply(EEt[i][2], e[2][j]);
+            A.row(1 + i * 3 + j) = p.transpose();
+        }
+    }
+
+    // Gauss-Jordan: every leading cubic as a combination of the basis monomials
+    Eigen::PartialPivLU<Eigen::Matrix<double, 10, 10>> lu(A.leftCols<10>());
+    Eigen::Matrix<double, 10, 10> G = lu.solve(A.rightCols<10>());
+    if (!G.allFinite()) {
+        return 0;
+    }
+
+    // action matrix of multiplication by x on the basis x^2 xy y^2 xz yz z^2 x y z 1
+    Eigen::Matrix<double, 10, 10> action = Eigen::Matrix<double, 10, 10>::Zero();
+    for (int i = 0; i < 6; ++i) {
+        action.row(i) = -G.row(x_times_basis_row[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        action(x_times_basis_shift[i][0], x_times_basis_shift[i][1]) = 1;
+    }
+
+    // eigenvectors are the basis monomials evaluated at the solutions
+    Eigen::EigenSolver<Eigen::Matrix<double, 10, 10>> eigen(action);
+    if (eigen.info() != Eigen::Success) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int k = 0; k < 10; ++k) {
+        if (std::abs(eigen.eigenvalues()[k].imag()) > 1.0e-10) {
+            continue;
+        }
+        Eigen::Matrix<double, 10, 1> v = eigen.eigenvectors().col(k).real();
+        if (std::abs(v[9]) < 1.0e-12) {
+            continue;
+        }
+        double x = v[6] / v[9], y = v[7] / v[9], z = v[8] / v[9];
+        Eigen::Matrix<double, 9, 1> ev = x * V.col(5) + y * V.col(6) + z * V.col(7) + V.col(8);
+        E[count++] = Eigen::Map<mat3d>(ev.data()).normalized().cast<real>();
+    }
+    return count;
+}
+
+FivePointEssentialRANSAC::FivePointEssentialRANSAC(const mat3 & K, real sigma, real success_rate, size_t max_iter)
+    : RANSAC(success_rate, max_iter), EssentialRANSAC(K, sigma)
+{}
+
+FivePointEssentialRANSAC::~FivePointEssentialRANSAC() = default;
+
+real FivePointEssentialRANSAC::estimate(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches, const std::vector<real> &quality) {
+    set_dataset(pa, pb, matches);
+    set_quality(quality);
+    run();
+    return score;
+}
+
+size_t FivePointEssentialRANSAC::fit_model(size_t slot, const sample_type &sample_set) {
+    vec2 a[5], b[5];
+    for (size_t i = 0; i < sample_size; ++i) {
+        a[i] = vec2(m_pairs.ax[sample_set[i]], m_pairs.ay[sample_set[i]]);
+        b[i] = vec2(m_pairs.bx[sample_set[i]], m_pairs.by[sample_set[i]]);
+    }
+    return solve_essential_five_point(a, b, m_slots[slot].E);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include "EssentialRANSAC.h"
+
+namespace slam {
+
+    /*
+    Essential matrix from minimal samples of five matches (Nister 2004, in the Groebner basis
+    form of Stewenius et al. 2006). A sample gives up to ten essential matrices, each is
+    scored on the data. The final model is refined with the eight-point solver on all inliers.
+    */
+    class FivePointEssentialRANSAC : public RANSAC<FivePointEssentialRANSAC, 5>, public EssentialRANSAC {
+    public:
+        FivePointEssentialRANSAC(const mat3 &K, real sigma = 1.0f, real success_rate = 0.99f, size_t max_iter = 10000000);
+        ~FivePointEssentialRANSAC();
+
+        real estimate(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches, const std::vector<real> &quality) override;
+
+    private:
+        friend class RANSAC<FivePointEssentialRANSAC, 5>;
+
+        size_t fit_model(size_t slot, const sample_type &sample_set);
+    };
+
+    /*
+    All essential matrices E with pb^T E pa = 0 for five normalized point pairs, up to ten.
+    Returns their number, 0 for a degenerate sample.
+    */
+    size_t solve_essential_five_point(const vec2 *pa, const vec2 *pb, std::array<mat3, 10> &E);
+
+}
@@ -5,17 +5,23 @@ using namespace slam;
 
 FourPointHomographyRANSAC::FourPointHomographyRANSAC(const mat3 & K, real sigma, real success_rate, size_t max_iter)
     : RANSAC(success_rate, max_iter), K(K), m_sigma(sigma), H(mat3::Zero())
-{
-    a.resize(4);
-    b.resize(4);
-}
+{}
 
 FourPointHomographyRANSAC::~FourPointHomographyRANSAC() = default;
 
-void FourPointHomographyRANSAC::set_dataset(const std::vector<vec2>& pa, const std::vector<vec2>& pb, const match_vector & matches) {
+void FourPointHomographyRANSAC::set_dataset(const KeypointArray& pa, const KeypointArray& pb, const match_vector & matches) {
     m_ppa = &pa;
     m_ppb = &pb;
     m_pmatches = &matches;
+
+    m_pairs.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i) {
+        m_pairs.ax[i] = pa.x[matches[i].first];
+        m_pairs.ay[i] = pa.y[matches[i].first];
+        m_pairs.bx[i] = pb.x[matches[i].second];
+        m_pairs.by[i] = pb.y[matches[i].second];
+    }
+    m_score_params = ScoreParams{ K(0, 0), K(1, 1), 1.0f / (m_sigma*m_sigma) };
 }
 
 size_t FourPointHomographyRANSAC::data_size() const {
@@ -27,10 +33,6 @@ size_t FourPointHomographyRANSAC::data_size() const {
     }
 }
 
-size_t FourPointHomographyRANSAC::sample_size() const {
-    return 4;
-}
-
 void FourPointHomographyRANSAC::reset_model() {
     H = mat3::Zero();
     matches.clear();
@@ -38,68 +40,52 @@ void FourPointHomographyRANSAC::reset_model() {
     score = 0;
 }
 
-void FourPointHomographyRANSAC::fit_model(const std::vector<size_t>& sample_set) {
-    const std::vector<vec2> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
-    const match_vector &matches = *m_pmatches;
+void FourPointHomographyRANSAC::reset_slots(size_t count) {
+    m_slots.resize(count);
+}
 
-    for (size_t i = 0; i < sample_set.size(); ++i) {
-        a[i] = pa[matches[sample_set[i]].first];
-        b[i] = pb[matches[sample_set[i]].second];
+size_t FourPointHomographyRANSAC::fit_model(size_t slot, const sample_type &sample_set) {
+    Slot &s = m_slots[slot];
+    for (size_t i = 0; i < sample_size; ++i) {
+        s.a[i] = vec2(m_pairs.ax[sample_set[i]], m_pairs.ay[sample_set[i]]);
+        s.b[i] = vec2(m_pairs.bx[sample_set[i]], m_pairs.by[sample_set[i]]);
     }
 
-    H = solve_homography(a, b);
+    s.H = solve_homography(s.a, s.b);
+    s.Hinv = s.H.inverse();
+    return 1;
 }
 
-real FourPointHomographyRANSAC::eval_model(std::vector<bool>& inlier_set, size_t & inlier_count) {
-    const std::vector<vec2> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
-    const match_vector &matches = *m_pmatches;
-
-    const real chi_square_essential = 3.841f;
-    const real chi_square_homography = 5.991f;
+size_t FourPointHomographyRANSAC::fit_local(size_t slot, const std::vector<size_t> &sample_set) {
+    Slot &s = m_slots[slot];
+    s.la.resize(sample_set.size());
+    s.lb.resize(sample_set.size());
+    for (size_t i = 0; i < sample_set.size(); ++i) {
+        s.la[i] = vec2(m_pairs.ax[sample_set[i]], m_pairs.ay[sample_set[i]]);
+        s.lb[i] = vec2(m_pairs.bx[sample_set[i]], m_pairs.by[sample_set[i]]);
+    }
 
-    const real inv_sigma_square = 1.0f / (m_sigma*m_sigma);
-    const mat3 Hinv = H.inverse();
+    s.H = solve_homography(s.la, s.lb);
+    s.Hinv = s.H.inverse();
+    return 1;
+}
 
-    real chi_square_score = 0;
-    inlier_count = 0;
+real FourPointHomographyRANSAC::eval_block(size_t slot, size_t, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask) {
+    const Slot &s = m_slots[slot];
+    return score_homography(s.H, s.Hinv, m_pairs, begin, end, m_score_params.widened(threshold_scale), mask);
+}
 
-    for (size_t i = 0; i < matches.size(); ++i) {
-        const vec2 &a = pa[matches[i].first];
-        const vec2 &b = pb[matches[i].second];
-        vec3 Ha(H(0, 0)*a(0) + H(0, 1)*a(1) + H(0, 2),
-            H(1, 0)*a(0) + H(1, 1)*a(1) + H(1, 2),
-            H(2, 0)*a(0) + H(2, 1)*a(1) + H(2, 2));
-        vec3 Hinvb(Hinv(0, 0)*b(0) + Hinv(0, 1)*b(1) + Hinv(0, 2),
-            Hinv(1, 0)*b(0) + Hinv(1, 1)*b(1) + Hinv(1, 2),
-            Hinv(2, 0)*b(0) + Hinv(2, 1)*b(1) + Hinv(2, 2));
-
-        real bx = (Ha(0) / Ha(2) - b(0))*K(0, 0);
-        real by = (Ha(1) / Ha(2) - b(1))*K(1, 1);
-        real ax = (Hinvb(0) / Hinvb(2) - a(0))*K(0, 0);
-        real ay = (Hinvb(1) / Hinvb(2) - a(1))*K(1, 1);
-
-        real D1_square = bx*bx + by*by;
-        real D2_square = ax*ax + ay*ay;
-        real chi_square_1 = D1_square*inv_sigma_square;
-        real chi_square_2 = D2_square*inv_sigma_square;
-        if (chi_square_1 < chi_square_homography && chi_square_2 < chi_square_homography) {
-            inlier_set[i] = true;
-            chi_square_score += 2.0f*chi_square_homography - chi_square_1 - chi_square_2;
-            inlier_count++;
-        }
-        else {
-            inlier_set[i] = false;
-        }
-    }
+void FourPointHomographyRANSAC::keep_model(size_t slot, size_t) {
+    m_slots[slot].best_H = m_slots[slot].H;
+}
 
-    return chi_square_score;
+void FourPointHomographyRANSAC::use_model(size_t slot) {
+    H = m_slots[slot].best_H;
 }
 
-void FourPointHomographyRANSAC::refine_model(const std::vector<bool>& inlier_set) {
-    const std::vector<vec2> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
+void FourPointHomographyRANSAC::refine_model(const InlierMask &inlier_set) {
+    const KeypointArray &pa = *m_ppa;
+    const KeypointArray &pb = *m_ppb;
     const match_vector &old_matches = *m_pmatches;
 
     matches.clear();
@@ -111,7 +97,7 @@ void FourPointHomographyRANSAC::refine_model(const std::vector<bool>& inlier_set
     }
     matches.shrink_to_fit();
 
-    if (matches.size() < sample_size()) {
+    if (matches.size() < sample_size) {
         return;
     }
 
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <array>
 #include "RANSAC.h"
+#include "ScoreKernels.h"
 
 namespace slam {
 
-    class FourPointHomographyRANSAC : public RANSAC {
+    class FourPointHomographyRANSAC : public RANSAC<FourPointHomographyRANSAC, 4> {
     public:
         mat3 H;
         match_vector matches;
@@ -12,29 +14,47 @@ namespace slam {
         FourPointHomographyRANSAC(const mat3 &K, real sigma = 1.0f, real success_rate = 0.99f, size_t max_iter = 10000000);
         ~FourPointHomographyRANSAC();
 
-        void set_dataset(const std::vector<vec2> &pa, const std::vector<vec2> &pb, const match_vector &matches);
+        void set_dataset(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches);
 
-    protected:
-        size_t data_size() const override;
+    private:
+        friend class RANSAC<FourPointHomographyRANSAC, 4>;
 
-        size_t sample_size() const override;
+        size_t data_size() const;
 
-        void reset_model() override;
+        void reset_model();
 
-        std::vector<vec2> a, b;
-        void fit_model(const std::vector<size_t> &sample_set) override;
+        void reset_slots(size_t count);
 
-        real eval_model(std::vector<bool> &inlier_set, size_t &inlier_count) override;
+        size_t fit_model(size_t slot, const sample_type &sample_set);
 
-        void refine_model(const std::vector<bool> &inlier_set) override;
+        size_t fit_local(size_t slot, const std::vector<size_t> &sample_set);
 
-    private:
-        const std::vector<vec2> *m_ppa = nullptr;
-        const std::vector<vec2> *m_ppb = nullptr;
+        real eval_block(size_t slot, size_t model, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask);
+
+        void keep_model(size_t slot, size_t model);
+
+        void use_model(size_t slot);
+
+        void refine_model(const InlierMask &inlier_set);
+
+        const KeypointArray *m_ppa = nullptr;
+        const KeypointArray *m_ppb = nullptr;
         const match_vector *m_pmatches = nullptr;
 
+        PairArray m_pairs; // matched points, gathered by set_dataset
+        ScoreParams m_score_params;
+
         real m_sigma;
         mat3 K;
+
+        struct Slot {
+            mat3 H;
+            mat3 Hinv;
+            mat3 best_H;
+            std::array<vec2, 4> a, b; // fitting buffers
+            std::vector<vec2> la, lb; // of local optimization
+        };
+        std::vector<Slot> m_slots;
     };
 
 }
@@ -1,19 +1,123 @@
+#include <complex>
+#include <limits>
 #include "FourPointPnPRANSAC.h"
-#include "Geometry.h"
-#include <opencv2/opencv.hpp>
 
 using namespace slam;
 
+// Gauss-Newton iterations of the final pose refinement, and of each local optimization step.
+static const int refine_iterations = 10;
+static const int local_iterations = 3;
+
+/*
+Rotation and translation with X = R P + T for three point pairs (Horn/Kabsch).
+*/
+static void align_points(const vec3d *P, const vec3d *X, mat3d &R, vec3d &T) {
+    vec3d P_mean = (P[0] + P[1] + P[2]) / 3.0;
+    vec3d X_mean = (X[0] + X[1] + X[2]) / 3.0;
+    mat3d S = mat3d::Zero();
+    for (int i = 0; i < 3; ++i) {
+        S += (X[i] - X_mean) * (P[i] - P_mean).transpose();
+    }
+    Eigen::JacobiSVD<mat3d> svd(S, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    mat3d D = mat3d::Identity();
+    if ((svd.matrixU() * svd.matrixV().transpose()).determinant() < 0) {
+        D(2, 2) = -1;
+    }
+    R = svd.matrixU() * D * svd.matrixV().transpose();
+    T = X_mean - R * P_mean;
+}
+
+size_t slam::solve_p3p(const vec3d *P, const vec2 *p, std::array<mat3d, 4> &R, std::array<vec3d, 4> &T) {
+    vec3d f[3];
+    for (int i = 0; i < 3; ++i) {
+        f[i] = vec3d(p[i].x(), p[i].y(), 1.0).normalized();
+    }
+
+    // Grunert's system with s2 = u s1, s3 = v s1: the law of cosines for the three sides
+    // gives u as a rational function N(v) / D(v) and a quartic in v
+    double a2 = (P[1] - P[2]).squaredNorm();
+    double b2 = (P[0] - P[2]).squaredNorm();
+    double c2 = (P[0] - P[1]).squaredNorm();
+    if (b2 < 1.0e-12) {
+        return 0;
+    }
+    double cos_alpha = f[1].dot(f[2]), cos_beta = f[0].dot(f[2]), cos_gamma = f[0].dot(f[1]);
+    double amc = (a2 - c2) / b2, cb = c2 / b2;
+
+    // N^2 - 2 cos(gamma) N D + D^2 (1 - c^2/b^2 (1 + v^2 - 2 v cos(beta))) = 0, coefficients by ascending power
+    const double N[3] = { 1 + amc, -2 * amc*cos_beta, amc - 1 };
+    const double D[2] = { 2 * cos_gamma, -2 * cos_alpha };
+    const double Q[3] = { 1 - cb, 2 * cb*cos_beta, -cb };
+    double DD[3] = { D[0] * D[0], 2 * D[0] * D[1], D[1] * D[1] };
+    double A[5] = { 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            A[i + j] += N[i] * N[j] + DD[i] * Q[j];
+        }
+        for (int j = 0; j < 2; ++j) {
+            A[i + j] -= 2 * cos_gamma*N[i] * D[j];
+        }
+    }
+    if (std::abs(A[4]) < 1.0e-12) {
+        return 0;
+    }
+
+    mat4d companion = mat4d::Zero();
+    companion(0, 0) = -A[3] / A[4];
+    companion(0, 1) = -A[2] / A[4];
+    companion(0, 2) = -A[1] / A[4];
+    companion(0, 3) = -A[0] / A[4];
+    companion(1, 0) = companion(2, 1) = companion(3, 2) = 1;
+    Eigen::EigenSolver<mat4d> roots(companion, false);
+    if (roots.info() != Eigen::Success) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int k = 0; k < 4; ++k) {
+        std::complex<double> root = roots.eigenvalues()[k];
+        if (std::abs(root.imag()) > 1.0e-8 * std::max(1.0, std::abs(root.real()))) {
+            continue;
+        }
+        double v = root.real();
+        double denominator = D[0] + D[1] * v;
+        if (std::abs(denominator) < 1.0e-12) {
+            continue;
+        }
+        double u = (N[0] + N[1] * v + N[2] * v*v) / denominator;
+        double s1_square = c2 / (1 + u*u - 2 * u*cos_gamma);
+        if (!(s1_square > 0) || u <= 0 || v <= 0) {
+            continue; // complex or behind the camera
+        }
+        double s1 = std::sqrt(s1_square);
+        vec3d X[3] = { s1*f[0], u*s1*f[1], v*s1*f[2] };
+        align_points(P, X, R[count], T[count]);
+        count++;
+    }
+    return count;
+}
+
 FourPointPnPRANSAC::FourPointPnPRANSAC(const mat3 & K, real sigma, real success_rate, size_t max_iter)
     : RANSAC(success_rate, max_iter), K(K), m_sigma(sigma), R(mat3::Identity()), T(vec3::Zero())
 {}
 
 FourPointPnPRANSAC::~FourPointPnPRANSAC() = default;
 
-void FourPointPnPRANSAC::set_dataset(const std::vector<vec3d>& pa, const std::vector<vec2>& pb, const match_vector & matches) {
+void FourPointPnPRANSAC::set_dataset(const std::vector<vec3d>& pa, const KeypointArray& pb, const match_vector & matches) {
     m_ppa = &pa;
     m_ppb = &pb;
     m_pmatches = &matches;
+
+    m_points.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i) {
+        const vec3d &p = pa[matches[i].first];
+        m_points.px[i] = (float)p.x();
+        m_points.py[i] = (float)p.y();
+        m_points.pz[i] = (float)p.z();
+        m_points.bx[i] = pb.x[matches[i].second];
+        m_points.by[i] = pb.y[matches[i].second];
+    }
+    m_score_params = ScoreParams{ K(0, 0), K(1, 1), 1.0f / (m_sigma*m_sigma) };
 }
 
 size_t FourPointPnPRANSAC::data_size() const {
@@ -25,10 +129,6 @@ size_t FourPointPnPRANSAC::data_size() const {
     }
 }
 
-size_t FourPointPnPRANSAC::sample_size() const {
-    return 4;
-}
-
 void FourPointPnPRANSAC::reset_model() {
     R = mat3::Identity();
     T = vec3::Zero();
@@ -37,116 +137,129 @@ void FourPointPnPRANSAC::reset_model() {
     score = 0;
 }
 
-void FourPointPnPRANSAC::fit_model(const std::vector<size_t>& sample_set) {
-    const std::vector<vec3d> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
-    const match_vector &matches = *m_pmatches;
-
-    std::vector<cv::Point3f> world_point(sample_set.size());
-    std::vector<cv::Point2f> image_point(sample_set.size());
-    for (size_t i = 0; i < sample_set.size(); ++i) {
-        world_point[i].x = (float)pa[matches[sample_set[i]].first].x();
-        world_point[i].y = (float)pa[matches[sample_set[i]].first].y();
-        world_point[i].z = (float)pa[matches[sample_set[i]].first].z();
-        image_point[i].x = pb[matches[sample_set[i]].second].x();
-        image_point[i].y = pb[matches[sample_set[i]].second].y();
-    }
-
-    cv::Mat rvec, tvec, rmat;
-    cv::solvePnP(world_point, image_point, cv::Mat::eye(3, 3, CV_32FC1), cv::noArray(), rvec, tvec, false, cv::SOLVEPNP_P3P);
-    cv::Rodrigues(rvec, rmat);
-    R(0, 0) = (real)rmat.at<double>(0, 0);
-    R(0, 1) = (real)rmat.at<double>(0, 1);
-    R(0, 2) = (real)rmat.at<double>(0, 2);
-    R(1, 0) = (real)rmat.at<double>(1, 0);
-    R(1, 1) = (real)rmat.at<double>(1, 1);
-    R(1, 2) = (real)rmat.at<double>(1, 2);
-    R(2, 0) = (real)rmat.at<double>(2, 0);
-    R(2, 1) = (real)rmat.at<double>(2, 1);
-    R(2, 2) = (real)rmat.at<double>(2, 2);
-    T(0) = (real)tvec.at<double>(0);
-    T(1) = (real)tvec.at<double>(1);
-    T(2) = (real)tvec.at<double>(2);
+void FourPointPnPRANSAC::reset_slots(size_t count) {
+    m_slots.resize(count);
 }
 
-real FourPointPnPRANSAC::eval_model(std::vector<bool>& inlier_set, size_t & inlier_count) {
-    const std::vector<vec3d> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
-    const match_vector &matches = *m_pmatches;
-
-    const real chi_square_essential = 3.841f;
-    const real chi_square_homography = 5.991f;
-
-    const real inv_sigma_square = 1.0f / (m_sigma*m_sigma);
-
-    real chi_square_score = 0;
-    inlier_count = 0;
+size_t FourPointPnPRANSAC::fit_model(size_t slot, const sample_type &sample_set) {
+    vec3d P[4];
+    vec2 p[4];
+    for (size_t i = 0; i < sample_size; ++i) {
+        size_t j = sample_set[i];
+        P[i] = vec3d(m_points.px[j], m_points.py[j], m_points.pz[j]);
+        p[i] = vec2(m_points.bx[j], m_points.by[j]);
+    }
 
-    for (size_t i = 0; i < matches.size(); ++i) {
-        vec3 a = pa[matches[i].first].cast<real>();
-        const vec2 &b = pb[matches[i].second];
-
-        vec3 p = R*a + T;
-        vec2 diff = (p.topLeftCorner<2, 1>() / p(2)) - b;
-        real diff_x = diff.x()*K(0, 0);
-        real diff_y = diff.y()*K(1, 1);
-        real chi_square = (diff_x*diff_x + diff_y*diff_y)*inv_sigma_square;
-
-        if (chi_square < chi_square_homography) {
-            inlier_set[i] = true;
-            chi_square_score += chi_square_homography - chi_square;
-            inlier_count++;
+    // three points give up to four poses, the fourth picks one
+    std::array<mat3d, 4> Rs;
+    std::array<vec3d, 4> Ts;
+    size_t count = solve_p3p(P, p, Rs, Ts);
+    double best_error = std::numeric_limits<double>::infinity();
+    for (size_t k = 0; k < count; ++k) {
+        vec3d X = Rs[k] * P[3] + Ts[k];
+        if (X.z() <= 0) {
+            continue;
         }
-        else {
-            inlier_set[i] = false;
+        double error = (X.head<2>() / X.z() - p[3].cast<double>()).squaredNorm();
+        if (error < best_error) {
+            best_error = error;
+            m_slots[slot].R = Rs[k].cast<real>();
+            m_slots[slot].T = Ts[k].cast<real>();
         }
     }
+    return best_error < std::numeric_limits<double>::infinity() ? 1 : 0;
+}
 
-    return chi_square_score;
+size_t FourPointPnPRANSAC::fit_local(size_t slot, const std::vector<size_t> &sample_set) {
+    Slot &s = m_slots[slot];
+    s.R = s.best_R;
+    s.T = s.best_T;
+    optimize_pose(sample_set, local_iterations, s.R, s.T);
+    return 1;
 }
 
-void FourPointPnPRANSAC::refine_model(const std::vector<bool>& inlier_set) {
-    const std::vector<vec3d> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
+real FourPointPnPRANSAC::eval_block(size_t slot, size_t, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask) {
+    const Slot &s = m_slots[slot];
+    return score_projection(s.R, s.T, m_points, begin, end, m_score_params.widened(threshold_scale), mask);
+}
+
+void FourPointPnPRANSAC::keep_model(size_t slot, size_t) {
+    m_slots[slot].best_R = m_slots[slot].R;
+    m_slots[slot].best_T = m_slots[slot].T;
+}
+
+void FourPointPnPRANSAC::use_model(size_t slot) {
+    R = m_slots[slot].best_R;
+    T = m_slots[slot].best_T;
+}
+
+void FourPointPnPRANSAC::refine_model(const InlierMask &inlier_set) {
     const match_vector &old_matches = *m_pmatches;
 
+    std::vector<size_t> indices;
     matches.clear();
     matches.reserve(old_matches.size());
     for (size_t i = 0; i < old_matches.size(); ++i) {
         if (inlier_set[i]) {
+            indices.push_back(i);
             matches.push_back(old_matches[i]);
         }
     }
     matches.shrink_to_fit();
 
-    if (matches.size() < sample_size()) {
+    if (matches.size() < sample_size) {
         return;
     }
 
-    std::vector<cv::Point3f> world_point(matches.size());
-    std::vector<cv::Point2f> image_point(matches.size());
+    optimize_pose(indices, refine_iterations, R, T);
+}
 
-    for (size_t i = 0; i < matches.size(); ++i) {
-        world_point[i].x = (float)pa[matches[i].first].x();
-        world_point[i].y = (float)pa[matches[i].first].y();
-        world_point[i].z = (float)pa[matches[i].first].z();
-        image_point[i].x = pb[matches[i].second].x();
-        image_point[i].y = pb[matches[i].second].y();
-    }
-
-    cv::Mat rvec, tvec, rmat;
-    cv::solvePnP(world_point, image_point, cv::Mat::eye(3, 3, CV_32FC1), cv::noArray(), rvec, tvec, false, cv::SOLVEPNP_EPNP);
-    cv::Rodrigues(rvec, rmat);
-    R(0, 0) = (real)rmat.at<double>(0, 0);
-    R(0, 1) = (real)rmat.at<double>(0, 1);
-    R(0, 2) = (real)rmat.at<double>(0, 2);
-    R(1, 0) = (real)rmat.at<double>(1, 0);
-    R(1, 1) = (real)rmat.at<double>(1, 1);
-    R(1, 2) = (real)rmat.at<double>(1, 2);
-    R(2, 0) = (real)rmat.at<double>(2, 0);
-    R(2, 1) = (real)rmat.at<double>(2, 1);
-    R(2, 2) = (real)rmat.at<double>(2, 2);
-    T(0) = (real)tvec.at<double>(0);
-    T(1) = (real)tvec.at<double>(1);
-    T(2) = (real)tvec.at<double>(2);
+void FourPointPnPRANSAC::optimize_pose(const std::vector<size_t> &indices, int iterations, mat3 &R, vec3 &T) const {
+    const std::vector<vec3d> &pa = *m_ppa;
+    const KeypointArray &pb = *m_ppb;
+    const match_vector &all_matches = *m_pmatches;
+
+    // rotation updated on the left
+    mat3d Rd = R.cast<double>();
+    vec3d Td = T.cast<double>();
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+        Eigen::Matrix<double, 6, 1> g = Eigen::Matrix<double, 6, 1>::Zero();
+        for (size_t i : indices) {
+            const auto &m = all_matches[i];
+            vec3d RP = Rd * pa[m.first];
+            vec3d X = RP + Td;
+            if (X.z() <= 0) {
+                continue;
+            }
+            double iz = 1.0 / X.z();
+            vec2d r(X.x()*iz - pb.x[m.second], X.y()*iz - pb.y[m.second]);
+            Eigen::Matrix<double, 2, 3> dproj;
+            dproj << iz, 0, -X.x()*iz*iz,
+                0, iz, -X.y()*iz*iz;
+            mat3d RP_hat;
+            RP_hat << 0, -RP.z(), RP.y(),
+                RP.z(), 0, -RP.x(),
+                -RP.y(), RP.x(), 0;
+            Eigen::Matrix<double, 2, 6> J;
+            J.leftCols<3>() = -dproj * RP_hat;
+            J.rightCols<3>() = dproj;
+            H += J.transpose() * J;
+            g += J.transpose() * r;
+        }
+        Eigen::Matrix<double, 6, 1> step = H.ldlt().solve(-g);
+        if (!step.allFinite()) {
+            break;
+        }
+        vec3d omega = step.head<3>();
+        if (omega.norm() > 0) {
+            Rd = Eigen::AngleAxisd(omega.norm(), omega.normalized()).toRotationMatrix() * Rd;
+        }
+        Td += step.tail<3>();
+        if (step.squaredNorm() < 1.0e-16) {
+            break;
+        }
+    }
+    R = Rd.cast<real>();
+    T = Td.cast<real>();
 }
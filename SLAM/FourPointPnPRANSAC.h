@@ -1,10 +1,16 @@
 #pragma once
 
+#include <array>
 #include "RANSAC.h"
+#include "ScoreKernels.h"
 
 namespace slam {
 
-    class FourPointPnPRANSAC : public RANSAC {
+    /*
+    Camera pose from four 2D-3D matches: P3P on three of them, the fourth picks among
+    its up to four solutions. The final pose is refined by Gauss-Newton on all inliers.
+    */
+    class FourPointPnPRANSAC : public RANSAC<FourPointPnPRANSAC, 4> {
     public:
         mat3 R;
         vec3 T;
@@ -13,28 +19,55 @@ namespace slam {
         FourPointPnPRANSAC(const mat3 &K, real sigma = 1.0f, real success_rate = 0.99f, size_t max_iter = 10000000);
         ~FourPointPnPRANSAC();
 
-        void set_dataset(const std::vector<vec3d> &pa, const std::vector<vec2> &pb, const match_vector &matches);
+        void set_dataset(const std::vector<vec3d> &pa, const KeypointArray &pb, const match_vector &matches);
 
-    protected:
-        size_t data_size() const override;
+    private:
+        friend class RANSAC<FourPointPnPRANSAC, 4>;
 
-        size_t sample_size() const override;
+        size_t data_size() const;
 
-        void reset_model() override;
+        void reset_model();
 
-        void fit_model(const std::vector<size_t> &sample_set) override;
+        void reset_slots(size_t count);
 
-        real eval_model(std::vector<bool> &inlier_set, size_t &inlier_count) override;
+        size_t fit_model(size_t slot, const sample_type &sample_set);
 
-        void refine_model(const std::vector<bool> &inlier_set) override;
+        size_t fit_local(size_t slot, const std::vector<size_t> &sample_set);
+
+        real eval_block(size_t slot, size_t model, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask);
+
+        void keep_model(size_t slot, size_t model);
+
+        void use_model(size_t slot);
+
+        void refine_model(const InlierMask &inlier_set);
+
+        // Gauss-Newton on the reprojection errors of the given data points, from R, T.
+        void optimize_pose(const std::vector<size_t> &indices, int iterations, mat3 &R, vec3 &T) const;
 
-    private:
         const std::vector<vec3d> *m_ppa = nullptr;
-        const std::vector<vec2> *m_ppb = nullptr;
+        const KeypointArray *m_ppb = nullptr;
         const match_vector *m_pmatches = nullptr;
 
+        ProjectionArray m_points; // matched points, gathered by set_dataset
+        ScoreParams m_score_params;
+
         real m_sigma;
         mat3 K;
+
+        struct Slot {
+            mat3 R;
+            vec3 T;
+            mat3 best_R;
+            vec3 best_T;
+        };
+        std::vector<Slot> m_slots;
     };
 
+    /*
+    Poses R, T with x ~ R P + T for three world points P and their normalized image points p,
+    up to four. Returns their number.
+    */
+    size_t solve_p3p(const vec3d *P, const vec2 *p, std::array<mat3d, 4> &R, std::array<vec3d, 4> &T);
+
 }
@@ -1,9 +1,23 @@
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
 #include "Types.h"
 
 namespace slam {
 
+    // Sizes the scratch buffers of the solvers below, std::array ones are fixed already.
+    template <typename T, size_t N>
+    inline void resize_buffer(std::array<T, N> &, size_t) {}
+
+    template <typename T>
+    inline void resize_buffer(std::vector<T> &buffer, size_t n) {
+        buffer.resize(n);
+    }
+
     inline mat3 skew_matrix(const vec3 &u) {
         return (mat3() <<
             0, -u.z(), u.y(),
@@ -12,65 +26,69 @@ namespace slam {
             ).finished();
     }
 
+    /*
+    Translation and isotropic scale that move the centroid of n points to the origin
+    and their mean distance from it to sqrt(2) (Hartley). N > 0 fixes n at compile time.
+    */
+    template <size_t N = 0>
+    inline void normalization(const vec2 *p, size_t n, vec2 &mean, real &scale) {
+        const size_t count = N ? N : n;
+        mean = vec2::Zero();
+        for (size_t i = 0; i < count; ++i) {
+            mean += p[i];
+        }
+        mean /= (real)count;
+
+        real distance = 0;
+        for (size_t i = 0; i < count; ++i) {
+            distance += (p[i] - mean).norm();
+        }
+        scale = sqrt(2.0f) * count / distance;
+    }
+
     /*
     Solve essential matrix E that pb^T E pa = 0.
     In function, pa and pb are their projective coordinate, assuming the last factor is 1.
     pa and pb should be normalized, if not, use solve_essential.
-    number of points must be greater than 8.
+    number of points must be at least 8, N > 0 fixes it at compile time.
+    E is the eigenvector of the smallest eigenvalue of the 9x9 normal matrix A^T A.
     */
-    inline mat3 solve_essential_normalized(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
-        matx A;
-        A.resize(pa.size(), 9);
-
-        for (size_t i = 0; i < pa.size(); ++i) {
-            A(i, 0) = pa[i](0)*pb[i](0);
-            A(i, 1) = pa[i](0)*pb[i](1);
-            A(i, 2) = pa[i](0);
-
-            A(i, 3) = pa[i](1)*pb[i](0);
-            A(i, 4) = pa[i](1)*pb[i](1);
-            A(i, 5) = pa[i](1);
-
-            A(i, 6) = pb[i](0);
-            A(i, 7) = pb[i](1);
-            A(i, 8) = 1;
+    template <size_t N = 0>
+    inline mat3 solve_essential_normalized(const vec2 *pa, const vec2 *pb, size_t n = N) {
+        const size_t count = N ? N : n;
+        Eigen::Matrix<double, 9, 9> M = Eigen::Matrix<double, 9, 9>::Zero();
+        for (size_t i = 0; i < count; ++i) {
+            Eigen::Matrix<double, 9, 1> r;
+            double ax = pa[i](0), ay = pa[i](1), bx = pb[i](0), by = pb[i](1);
+            r << ax*bx, ax*by, ax, ay*bx, ay*by, ay, bx, by, 1;
+            M.selfadjointView<Eigen::Lower>().rankUpdate(r);
         }
 
-        vecx e = A.jacobiSvd(Eigen::ComputeFullV).matrixV().col(8);
-        return Eigen::Map<mat3>(e.data());
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> eigen(M);
+        Eigen::Matrix<double, 9, 1> e = eigen.eigenvectors().col(0);
+        return Eigen::Map<mat3d>(e.data()).cast<real>();
     }
 
     // Solve essential matrix with coordinate normalization
-    inline mat3 solve_essential(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
-        vec2 pa_mean = vec2::Zero();
-        vec2 pb_mean = vec2::Zero();
-        for (size_t i = 0; i < pa.size(); ++i) {
-            pa_mean += pa[i];
-            pb_mean += pb[i];
-        }
-        pa_mean /= (real)pa.size();
-        pb_mean /= (real)pb.size();
-
-        real sa = 0;
-        real sb = 0;
-        real sqrt2 = sqrt(2.0f);
-
-        for (size_t i = 0; i < pa.size(); ++i) {
-            sa += (pa[i] - pa_mean).norm();
-            sb += (pb[i] - pb_mean).norm();
-        }
-
-        sa = 1.0f / (sqrt2*sa);
-        sb = 1.0f / (sqrt2*sb);
-
-        std::vector<vec2> na(pa.size());
-        std::vector<vec2> nb(pb.size());
-        for (size_t i = 0; i < pa.size(); ++i) {
+    template <size_t N = 0>
+    inline mat3 solve_essential(const vec2 *pa, const vec2 *pb, size_t n = N) {
+        const size_t count = N ? N : n;
+        vec2 pa_mean, pb_mean;
+        real sa, sb;
+        normalization<N>(pa, count, pa_mean, sa);
+        normalization<N>(pb, count, pb_mean, sb);
+
+        // normalized copies live on the stack when the count is known
+        typedef typename std::conditional<N != 0, std::array<vec2, N>, std::vector<vec2>>::type buffer;
+        buffer na, nb;
+        resize_buffer(na, count);
+        resize_buffer(nb, count);
+        for (size_t i = 0; i < count; ++i) {
             na[i] = (pa[i] - pa_mean)*sa;
             nb[i] = (pb[i] - pb_mean)*sb;
         }
 
-        mat3 E = solve_essential_normalized(na, nb);
+        mat3 E = solve_essential_normalized<N>(na.data(), nb.data(), count);
 
         mat3 Na, Nb;
         Nb << sb, 0, 0,
@@ -85,6 +103,15 @@ namespace slam {
         return E;
     }
 
+    template <size_t N>
+    inline mat3 solve_essential(const std::array<vec2, N> &pa, const std::array<vec2, N> &pb) {
+        return solve_essential<N>(pa.data(), pb.data());
+    }
+
+    inline mat3 solve_essential(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
+        return solve_essential<0>(pa.data(), pb.data(), pa.size());
+    }
+
     /*
     Essential matrix must be a rank-2 matrix with two singular-values equal to 1.
     */
@@ -95,19 +122,29 @@ namespace slam {
         return svd.matrixU()*fs.asDiagonal()*svd.matrixV().transpose();
     }
 
+    /*
+    Point seen at p1 and p2 by cameras x = R P + T, from the linear equations
+    p.x (R P + T).z = (R P + T).x and likewise for y, solved in closed form by
+    3x3 normal equations. Not finite when the rays are parallel.
+    */
     inline vec3 triangulate2(const mat3 &R1, const vec3 &T1, const vec2 &p1, const mat3 &R2, const vec3 &T2, const vec2 &p2) {
-        mat4 A;
-        A.block<1, 3>(0, 0) = p1(0)*R1.row(2) - R1.row(0);
-                    A(0, 3) = p1(0)*T1(2)     - T1(0);
-        A.block<1, 3>(1, 0) = p1(1)*R1.row(2) - R1.row(1);
-                    A(1, 3) = p1(1)*T1(2)     - T1(1);
-        A.block<1, 3>(2, 0) = p2(0)*R2.row(2) - R2.row(0);
-                    A(2, 3) = p2(0)*T2(2)     - T2(0);
-        A.block<1, 3>(3, 0) = p2(1)*R2.row(2) - R2.row(1);
-                    A(3, 3) = p2(1)*T2(2)     - T2(1);
-
-        vec4 x = A.jacobiSvd(Eigen::ComputeFullV).matrixV().col(3);
-        return x.topLeftCorner<3, 1>() / x(3);
+        Eigen::Matrix<real, 4, 3> A;
+        vec4 b;
+        A.row(0) = p1(0)*R1.row(2) - R1.row(0);
+        b(0) = T1(0) - p1(0)*T1(2);
+        A.row(1) = p1(1)*R1.row(2) - R1.row(1);
+        b(1) = T1(1) - p1(1)*T1(2);
+        A.row(2) = p2(0)*R2.row(2) - R2.row(0);
+        b(2) = T2(0) - p2(0)*T2(2);
+        A.row(3) = p2(1)*R2.row(2) - R2.row(1);
+        b(3) = T2(1) - p2(1)*T2(2);
+
+        mat3 M = A.transpose()*A;
+        real det = M.determinant();
+        if (!(std::abs(det) > std::numeric_limits<real>::epsilon()*M.squaredNorm()*M.norm())) {
+            return vec3::Constant(std::numeric_limits<real>::quiet_NaN());
+        }
+        return M.inverse()*(A.transpose()*b);
     }
 
     /*
@@ -164,65 +201,45 @@ namespace slam {
     Solve homography matrix H that pb x H pa = 0.
     In function, pa and pb are their projective coordinate, assuming the last factor is 1.
     pa and pb should be normalized, if not, use solve_homography.
-    number of points must be greater than 4.
+    number of points must be at least 4, N > 0 fixes it at compile time.
     */
-    inline mat3 solve_homography_normalized(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
-        matx A;
-        A.resize(pa.size() * 2, 9);
-        A.setZero();
-
-        for (size_t i = 0; i < pa.size(); ++i) {
-            const vec2 &a = pa[i];
-            const vec2 &b = pb[i];
-            A(i * 2, 1) = -a(0);
-            A(i * 2, 2) = a(0)*b(1);
-            A(i * 2, 4) = -a(1);
-            A(i * 2, 5) = a(1)*b(1);
-            A(i * 2, 7) = -1;
-            A(i * 2, 8) = b(1);
-            A(i * 2 + 1, 0) = a(0);
-            A(i * 2 + 1, 2) = -a(0)*b(0);
-            A(i * 2 + 1, 3) = a(1);
-            A(i * 2 + 1, 5) = -a(1)*b(0);
-            A(i * 2 + 1, 6) = 1;
-            A(i * 2 + 1, 8) = -b(0);
-        }
-
-        vecx h = A.jacobiSvd(Eigen::ComputeFullV).matrixV().col(8);
-        return Eigen::Map<mat3>(h.data());
-    }
-
-    // Solve homography matrix with coordinate normalization.
-    inline mat3 solve_homography(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
-        vec2 pa_mean = vec2::Zero();
-        vec2 pb_mean = vec2::Zero();
-        for (size_t i = 0; i < pa.size(); ++i) {
-            pa_mean += pa[i];
-            pb_mean += pb[i];
+    template <size_t N = 0>
+    inline mat3 solve_homography_normalized(const vec2 *pa, const vec2 *pb, size_t n = N) {
+        const size_t count = N ? N : n;
+        Eigen::Matrix<double, 9, 9> M = Eigen::Matrix<double, 9, 9>::Zero();
+        for (size_t i = 0; i < count; ++i) {
+            double ax = pa[i](0), ay = pa[i](1), bx = pb[i](0), by = pb[i](1);
+            Eigen::Matrix<double, 9, 1> r0, r1;
+            r0 << 0, -ax, ax*by, 0, -ay, ay*by, 0, -1, by;
+            r1 << ax, 0, -ax*bx, ay, 0, -ay*bx, 1, 0, -bx;
+            M.selfadjointView<Eigen::Lower>().rankUpdate(r0);
+            M.selfadjointView<Eigen::Lower>().rankUpdate(r1);
         }
-        pa_mean /= (real)pa.size();
-        pb_mean /= (real)pb.size();
-
-        real sa = 0;
-        real sb = 0;
-        real sqrt2 = sqrt(2.0f);
 
-        for (size_t i = 0; i < pa.size(); ++i) {
-            sa += (pa[i] - pa_mean).norm();
-            sb += (pb[i] - pb_mean).norm();
-        }
-
-        sa = 1.0f / (sqrt2*sa);
-        sb = 1.0f / (sqrt2*sb);
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> eigen(M);
+        Eigen::Matrix<double, 9, 1> h = eigen.eigenvectors().col(0);
+        return Eigen::Map<mat3d>(h.data()).cast<real>();
+    }
 
-        std::vector<vec2> na(pa.size());
-        std::vector<vec2> nb(pb.size());
-        for (size_t i = 0; i < pa.size(); ++i) {
+    // Solve homography matrix with coordinate normalization.
+    template <size_t N = 0>
+    inline mat3 solve_homography(const vec2 *pa, const vec2 *pb, size_t n = N) {
+        const size_t count = N ? N : n;
+        vec2 pa_mean, pb_mean;
+        real sa, sb;
+        normalization<N>(pa, count, pa_mean, sa);
+        normalization<N>(pb, count, pb_mean, sb);
+
+        typedef typename std::conditional<N != 0, std::array<vec2, N>, std::vector<vec2>>::type buffer;
+        buffer na, nb;
+        resize_buffer(na, count);
+        resize_buffer(nb, count);
+        for (size_t i = 0; i < count; ++i) {
             na[i] = (pa[i] - pa_mean)*sa;
             nb[i] = (pb[i] - pb_mean)*sb;
         }
 
-        mat3 H = solve_homography_normalized(na, nb);
+        mat3 H = solve_homography_normalized<N>(na.data(), nb.data(), count);
 
         mat3 Na, Nb;
         Nb << 1 / sb, 0, pb_mean(0),
@@ -237,6 +254,65 @@ namespace slam {
         return H;
     }
 
+    template <size_t N>
+    inline mat3 solve_homography(const std::array<vec2, N> &pa, const std::array<vec2, N> &pb) {
+        return solve_homography<N>(pa.data(), pb.data());
+    }
+
+    inline mat3 solve_homography(const std::vector<vec2> &pa, const std::vector<vec2> &pb) {
+        return solve_homography<0>(pa.data(), pb.data(), pa.size());
+    }
+
+    /*
+    Motion and structure from motion in a piecewise planar environment, O. Faugeras and F. Lustman, 1988.
+    H maps pa to pb of a plane seen by cameras x = P and x = R P + T, it gives up to 8 solutions
+    with unit T, again only the one with points in front of both cameras is right.
+    Returns the number of solutions, 0 when the singular values of H are (nearly) repeated.
+    */
+    inline size_t decompose_homography(const mat3 &H, std::array<mat3, 8> &R, std::array<vec3, 8> &T) {
+        Eigen::JacobiSVD<mat3d> svd(H.cast<double>(), Eigen::ComputeFullU | Eigen::ComputeFullV);
+        const mat3d &U = svd.matrixU();
+        const mat3d &V = svd.matrixV();
+        double s = U.determinant()*V.determinant();
+        double d1 = svd.singularValues()(0), d2 = svd.singularValues()(1), d3 = svd.singularValues()(2);
+        if (d1 / d2 < 1.00001 || d2 / d3 < 1.00001) {
+            return 0;
+        }
+
+        double x1 = std::sqrt((d1*d1 - d2*d2) / (d1*d1 - d3*d3));
+        double x3 = std::sqrt((d2*d2 - d3*d3) / (d1*d1 - d3*d3));
+        const double x1s[4] = { x1, x1, -x1, -x1 };
+        const double x3s[4] = { x3, -x3, x3, -x3 };
+
+        // d' = d2
+        double sin_theta = std::sqrt((d1*d1 - d2*d2)*(d2*d2 - d3*d3)) / ((d1 + d3)*d2);
+        double cos_theta = (d2*d2 + d1*d3) / ((d1 + d3)*d2);
+        const double sin_thetas[4] = { sin_theta, -sin_theta, -sin_theta, sin_theta };
+        for (int i = 0; i < 4; ++i) {
+            mat3d Rp;
+            Rp << cos_theta, 0, -sin_thetas[i],
+                0, 1, 0,
+                sin_thetas[i], 0, cos_theta;
+            R[i] = (s*U*Rp*V.transpose()).cast<real>();
+            T[i] = (U*vec3d(x1s[i], 0, -x3s[i])).normalized().cast<real>();
+        }
+
+        // d' = -d2
+        double sin_phi = std::sqrt((d1*d1 - d2*d2)*(d2*d2 - d3*d3)) / ((d1 - d3)*d2);
+        double cos_phi = (d1*d3 - d2*d2) / ((d1 - d3)*d2);
+        const double sin_phis[4] = { sin_phi, -sin_phi, -sin_phi, sin_phi };
+        for (int i = 0; i < 4; ++i) {
+            mat3d Rp;
+            Rp << cos_phi, 0, sin_phis[i],
+                0, -1, 0,
+                sin_phis[i], 0, -cos_phi;
+            R[i + 4] = (s*U*Rp*V.transpose()).cast<real>();
+            T[i + 4] = (U*vec3d(x1s[i], 0, x3s[i])).normalized().cast<real>();
+        }
+
+        return 8;
+    }
+
     inline vec2 project(const vec3 &p) {
         return p.topLeftCorner<2, 1>() / p.z();
     }
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cstring>
+#include "CpuFeatures.h"
+#include "Hamming.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SLAM_HAMMING_X86
+#include <immintrin.h>
+#endif
+
+using namespace slam;
+
+namespace {
+
+    typedef std::uint32_t(*distance_fn)(const std::uint8_t *, const std::uint8_t *);
+    typedef void(*distances_fn)(const std::uint8_t *, const std::uint8_t *, size_t, std::uint32_t *);
+    typedef void(*gather_fn)(const std::uint8_t *, const std::uint8_t *, const size_t *, size_t, std::uint32_t *);
+
+    struct HammingKernel {
+        const char *name;
+        distance_fn distance;
+        distances_fn distances;
+        gather_fn gather;
+    };
+
+    // Scalar fallback: SWAR popcount on 64-bit words.
+
+    inline std::uint32_t popcount64(std::uint64_t x) {
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+        return (std::uint32_t)((x * 0x0101010101010101ull) >> 56);
+    }
+
+    std::uint32_t distance_scalar(const std::uint8_t *a, const std::uint8_t *b) {
+        std::uint64_t x[4], y[4];
+        memcpy(x, a, descriptor_bytes);
+        memcpy(y, b, descriptor_bytes);
+        return popcount64(x[0] ^ y[0]) + popcount64(x[1] ^ y[1]) + popcount64(x[2] ^ y[2]) + popcount64(x[3] ^ y[3]);
+    }
+
+    void distances_scalar(const std::uint8_t *query, const std::uint8_t *train, size_t n, std::uint32_t *distances) {
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_scalar(query, train + j * descriptor_bytes);
+        }
+    }
+
+    void gather_scalar(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, std::uint32_t *distances) {
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_scalar(query, train + indices[j] * descriptor_bytes);
+        }
+    }
+
+#ifdef SLAM_HAMMING_X86
+
+    // SSE4.2 generation: hardware POPCNT on machine words.
+
+    SLAM_TARGET_POPCNT inline std::uint32_t distance_popcnt_inline(const std::uint8_t *a, const std::uint8_t *b) {
+#if defined(_M_X64) || defined(__x86_64__)
+        std::uint64_t x[4], y[4];
+        memcpy(x, a, descriptor_bytes);
+        memcpy(y, b, descriptor_bytes);
+        return (std::uint32_t)(_mm_popcnt_u64(x[0] ^ y[0]) + _mm_popcnt_u64(x[1] ^ y[1]) + _mm_popcnt_u64(x[2] ^ y[2]) + _mm_popcnt_u64(x[3] ^ y[3]));
+#else
+        std::uint32_t x[8], y[8];
+        memcpy(x, a, descriptor_bytes);
+        memcpy(y, b, descriptor_bytes);
+        std::uint32_t d = 0;
+        for (int i = 0; i < 8; ++i) {
+            d += (std::uint32_t)_mm_popcnt_u32(x[i] ^ y[i]);
+        }
+        return d;
+#endif
+    }
+
+    SLAM_TARGET_POPCNT std::uint32_t distance_popcnt(const std::uint8_t *a, const std::uint8_t *b) {
+        return distance_popcnt_inline(a, b);
+    }
+
+    SLAM_TARGET_POPCNT void distances_popcnt(const std::uint8_t *query, const std::uint8_t *train, size_t n, std::uint32_t *distances) {
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_popcnt_inline(query, train + j * descriptor_bytes);
+        }
+    }
+
+    SLAM_TARGET_POPCNT void gather_popcnt(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, std::uint32_t *distances) {
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_popcnt_inline(query, train + indices[j] * descriptor_bytes);
+        }
+    }
+
+    // AVX2 generation: a whole descriptor per register, nibble-lookup popcount (Mula et al.).
+
+    SLAM_TARGET_AVX2 inline std::uint32_t popcount256(__m256i v) {
+        const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_and_si256(v, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+        __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+        __m256i sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+        return (std::uint32_t)_mm_cvtsi128_si32(s);
+    }
+
+    SLAM_TARGET_AVX2 inline std::uint32_t distance_avx2_inline(__m256i q, const std::uint8_t *b) {
+        return popcount256(_mm256_xor_si256(q, _mm256_loadu_si256((const __m256i *)b)));
+    }
+
+    SLAM_TARGET_AVX2 std::uint32_t distance_avx2(const std::uint8_t *a, const std::uint8_t *b) {
+        return distance_avx2_inline(_mm256_loadu_si256((const __m256i *)a), b);
+    }
+
+    SLAM_TARGET_AVX2 void distances_avx2(const std::uint8_t *query, const std::uint8_t *train, size_t n, std::uint32_t *distances) {
+        __m256i q = _mm256_loadu_si256((const __m256i *)query);
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_avx2_inline(q, train + j * descriptor_bytes);
+        }
+    }
+
+    SLAM_TARGET_AVX2 void gather_avx2(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, std::uint32_t *distances) {
+        __m256i q = _mm256_loadu_si256((const __m256i *)query);
+        for (size_t j = 0; j < n; ++j) {
+            distances[j] = distance_avx2_inline(q, train + indices[j] * descriptor_bytes);
+        }
+    }
+
+#endif
+
+    HammingKernel select_kernel() {
+#ifdef SLAM_HAMMING_X86
+        const CpuFeatures &cpu = cpu_features();
+        if (cpu.avx2) {
+            return HammingKernel{ "avx2", distance_avx2, distances_avx2, gather_avx2 };
+        }
+        if (cpu.sse42 && cpu.popcnt) {
+            return HammingKernel{ "popcnt", distance_popcnt, distances_popcnt, gather_popcnt };
+        }
+#endif
+        return HammingKernel{ "scalar", distance_scalar, distances_scalar, gather_scalar };
+    }
+
+    const HammingKernel &kernel() {
+        static const HammingKernel k = select_kernel();
+        return k;
+    }
+
+    // distances are computed this many at a time for top-k, on the stack
+    const size_t knn_block = 64;
+
+    // Insertion into best, sorted over k slots, k is small.
+    inline void insert_match(HammingMatch *best, size_t k, std::uint32_t index, std::uint32_t d) {
+        if (d >= best[k - 1].distance) {
+            return;
+        }
+        size_t pos = k - 1;
+        while (pos > 0 && best[pos - 1].distance > d) {
+            best[pos] = best[pos - 1];
+            pos--;
+        }
+        best[pos].index = index;
+        best[pos].distance = d;
+    }
+
+}
+
+std::uint32_t slam::hamming_distance(const std::uint8_t *a, const std::uint8_t *b) {
+    return kernel().distance(a, b);
+}
+
+void slam::hamming_distances(const std::uint8_t *query, const std::uint8_t *train, size_t n, std::uint32_t *distances) {
+    kernel().distances(query, train, n, distances);
+}
+
+void slam::hamming_distances(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, std::uint32_t *distances) {
+    kernel().gather(query, train, indices, n, distances);
+}
+
+void slam::hamming_knn(const std::uint8_t *query, const std::uint8_t *train, size_t n, size_t k, HammingMatch *best) {
+    const HammingMatch none = { std::uint32_t(-1), std::uint32_t(-1) };
+    std::fill(best, best + k, none);
+    if (k == 0) {
+        return;
+    }
+
+    const HammingKernel &K = kernel();
+    std::uint32_t distances[knn_block];
+    for (size_t begin = 0; begin < n; begin += knn_block) {
+        size_t count = std::min(knn_block, n - begin);
+        K.distances(query, train + begin * descriptor_bytes, count, distances);
+        for (size_t j = 0; j < count; ++j) {
+            insert_match(best, k, (std::uint32_t)(begin + j), distances[j]);
+        }
+    }
+}
+
+void slam::hamming_knn(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, size_t k, HammingMatch *best) {
+    const HammingMatch none = { std::uint32_t(-1), std::uint32_t(-1) };
+    std::fill(best, best + k, none);
+    if (k == 0) {
+        return;
+    }
+
+    const HammingKernel &K = kernel();
+    std::uint32_t distances[knn_block];
+    for (size_t begin = 0; begin < n; begin += knn_block) {
+        size_t count = std::min(knn_block, n - begin);
+        K.gather(query, train, indices + begin, count, distances);
+        for (size_t j = 0; j < count; ++j) {
+            insert_match(best, k, (std::uint32_t)indices[begin + j], distances[j]);
+        }
+    }
+}
+
+void slam::hamming_knn(const DescriptorArray &query, const DescriptorArray &train, size_t k, std::vector<HammingMatch> &result) {
+    result.resize(query.size() * k);
+    for (size_t i = 0; i < query.size(); ++i) {
+        hamming_knn(query[i], train.data(), train.size(), k, result.data() + i * k);
+    }
+}
+
+const char *slam::hamming_kernel_name() {
+    return kernel().name;
+}
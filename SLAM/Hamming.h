@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "AlignedAllocator.h"
+
+namespace slam {
+
+    // 256-bit binary descriptors (ORB / rBRIEF)
+    const size_t descriptor_bytes = 32;
+
+    /*
+    Contiguous store of binary descriptors, one 32-byte aligned row per keypoint,
+    so that no row straddles a cache line. The kernels below use unaligned loads
+    and take descriptors from anywhere.
+    */
+    class DescriptorArray {
+    public:
+        void resize(size_t n) { m_data.resize(n * descriptor_bytes); }
+        void clear() { m_data.clear(); }
+        size_t size() const { return m_data.size() / descriptor_bytes; }
+        bool empty() const { return m_data.empty(); }
+
+        std::uint8_t *operator[](size_t i) { return m_data.data() + i * descriptor_bytes; }
+        const std::uint8_t *operator[](size_t i) const { return m_data.data() + i * descriptor_bytes; }
+
+        const std::uint8_t *data() const { return m_data.data(); }
+
+    private:
+        aligned_vector<std::uint8_t> m_data;
+    };
+
+    struct HammingMatch {
+        std::uint32_t index;
+        std::uint32_t distance;
+    };
+
+    // Distance between two descriptors.
+    std::uint32_t hamming_distance(const std::uint8_t *a, const std::uint8_t *b);
+
+    // 1-vs-N: distances[j] = |query ^ train[j]| for n contiguous train descriptors.
+    void hamming_distances(const std::uint8_t *query, const std::uint8_t *train, size_t n, std::uint32_t *distances);
+
+    // 1-vs-N over a subset: distances[j] = |query ^ train[indices[j]]|.
+    void hamming_distances(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, std::uint32_t *distances);
+
+    /*
+    Top-k: the k nearest of n contiguous train descriptors into best[0, k), in ascending
+    distance and ties in train order. Slots left over have index uint32_t(-1).
+    */
+    void hamming_knn(const std::uint8_t *query, const std::uint8_t *train, size_t n, size_t k, HammingMatch *best);
+
+    // Top-k over a subset, index is that of the train descriptor, not its position in indices.
+    void hamming_knn(const std::uint8_t *query, const std::uint8_t *train, const size_t *indices, size_t n, size_t k, HammingMatch *best);
+
+    // N-vs-M: top-k of every query descriptor over all of train, result has nq*k entries.
+    void hamming_knn(const DescriptorArray &query, const DescriptorArray &train, size_t k, std::vector<HammingMatch> &result);
+
+    // Name of the kernel picked for this CPU: "avx2", "popcnt" or "scalar".
+    const char *hamming_kernel_name();
+
+}
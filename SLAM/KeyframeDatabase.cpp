@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <unordered_map>
+#include "KeyframeDatabase.h"
+
+using namespace slam;
+
+KeyframeDatabase::KeyframeDatabase() = default;
+
+KeyframeDatabase::~KeyframeDatabase() = default;
+
+void KeyframeDatabase::clear() {
+    m_inverted_index.clear();
+    m_bows.clear();
+}
+
+void KeyframeDatabase::add(index_t keyframe, const BowVector &bow) {
+    if (m_bows.size() <= keyframe) {
+        m_bows.resize(keyframe + 1);
+    }
+    m_bows[keyframe] = bow;
+
+    for (auto &entry : bow) {
+        if (m_inverted_index.size() <= entry.first) {
+            m_inverted_index.resize(entry.first + 1);
+        }
+        m_inverted_index[entry.first].push_back(keyframe);
+    }
+}
+
+std::vector<std::pair<index_t, real>> KeyframeDatabase::query(const BowVector &bow, size_t max_results) const {
+    std::vector<std::pair<index_t, real>> result;
+
+    std::unordered_map<index_t, size_t> common_words;
+    for (auto &entry : bow) {
+        if (entry.first >= m_inverted_index.size()) {
+            continue;
+        }
+        for (index_t keyframe : m_inverted_index[entry.first]) {
+            common_words[keyframe]++;
+        }
+    }
+    if (common_words.empty()) {
+        return result;
+    }
+
+    size_t max_common = 0;
+    for (auto &c : common_words) {
+        max_common = std::max(max_common, c.second);
+    }
+    size_t min_common = max_common * 4 / 5;
+
+    for (auto &c : common_words) {
+        if (c.second >= min_common) {
+            result.emplace_back(c.first, Vocabulary::score(bow, m_bows[c.first]));
+        }
+    }
+
+    std::sort(result.begin(), result.end(), [](const std::pair<index_t, real> &a, const std::pair<index_t, real> &b) { return a.second > b.second; });
+    if (result.size() > max_results) {
+        result.resize(max_results);
+    }
+    return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include "Types.h"
+#include "Vocabulary.h"
+
+namespace slam {
+
+    /*
+    Inverted index from vocabulary words to the keyframes that contain them,
+    used to find keyframes that look like a given image.
+    */
+    class KeyframeDatabase {
+    public:
+        KeyframeDatabase();
+        ~KeyframeDatabase();
+
+        void clear();
+
+        void add(index_t keyframe, const BowVector &bow);
+
+        /*
+        Keyframes sharing enough words with bow, best L1 score first.
+        Only keyframes with at least 80% of the largest common word count are scored.
+        */
+        std::vector<std::pair<index_t, real>> query(const BowVector &bow, size_t max_results) const;
+
+    private:
+        std::vector<std::vector<index_t>> m_inverted_index;
+        std::vector<BowVector> m_bows; // indexed by keyframe id
+    };
+
+}
@@ -1,11 +1,13 @@
+#include <future>
 #include <unordered_set>
 #include "LazyPairInitializer.h"
 #include "Config.h"
 #include "Tracker.h"
 #include "Feature.h"
-#include "EightPointEssentialRANSAC.h"
+#include "EssentialRANSAC.h"
 #include "FourPointHomographyRANSAC.h"
 #include "Triangulator.h"
+#include "ThreadPool.h"
 
 #include "OcvHelperFunctions.h"
 
@@ -19,26 +21,27 @@ LazyPairInitializer::LazyPairInitializer(const Config *config) {
     real success_rate = (real)config->value("RANSAC.successRate", 0.99);
     size_t max_iter = (size_t)config->value("RANSAC.maxIteration", 10000000);
 
-    m_essential_ransac = std::make_unique<EightPointEssentialRANSAC>(
-        config->K,
-        (real)config->value("RANSAC.Essential.sigma", sigma),
-        (real)config->value("RANSAC.Essential.successRate", success_rate),
-        (size_t)config->value("RANSAC.Essential.maxIteration", (double)max_iter)
-    );
-
     m_homography_ransac = std::make_unique<FourPointHomographyRANSAC>(
         config->K,
-        (real)config->value("RANSAC.Essential.sigma", sigma*10),
-        (real)config->value("RANSAC.Essential.successRate", success_rate),
-        (size_t)config->value("RANSAC.Essential.maxIteration", (double)max_iter)
+        (real)config->value("RANSAC.Homography.sigma", sigma),
+        (real)config->value("RANSAC.Homography.successRate", success_rate),
+        (size_t)config->value("RANSAC.Homography.maxIteration", (double)max_iter)
     );
 
+    m_ransac_pool = std::make_unique<ThreadPool>((size_t)config->value("RANSAC.threads", 0));
+    m_essential_ransac = EssentialRANSAC::create(config, m_ransac_pool.get());
+    m_homography_ransac->set_thread_pool(m_ransac_pool.get());
+    m_homography_ransac->set_seed((unsigned int)config->value("RANSAC.seed", 0));
+    m_homography_ransac->set_local_optimization((size_t)config->value("RANSAC.localOptimization", 0));
+
     m_triangulator = std::make_unique<Triangulator>(
         config->K,
         (real)config->value("Triangulation.sigma", 2.0*sigma)
     );
+    m_triangulator->set_thread_pool(m_ransac_pool.get());
 
     m_min_parallax = (real)config->value("Triangulation.minParallax", 1.0f);
+    m_homography_ratio = (real)config->value("Initializer.homographyRatio", 0.45);
     m_K = config->K;
 }
 
@@ -51,19 +54,37 @@ void LazyPairInitializer::reset() {
 bool LazyPairInitializer::initialize(const std::shared_ptr<Frame> &pframe) {
     if (m_first_frame) {
         m_frame_count++;
-        match_vector matches = m_first_frame->feature->match(pframe->feature.get(), 5, 0.5f*m_K(0, 2) / m_K(0, 0));
+        std::vector<real> quality;
+        match_vector matches = m_first_frame->feature->match(pframe->feature.get(), 0.5f*m_K(0, 2) / m_K(0, 0), nullptr, &quality);
         size_t N = matches.size();
 
-        m_essential_ransac->set_dataset(m_first_frame->feature->keypoints, pframe->feature->keypoints, matches);
-        m_essential_ransac->run();
-        matches.swap(m_essential_ransac->matches);
+        const KeypointArray &pa = m_first_frame->feature->keypoints;
+        const KeypointArray &pb = pframe->feature->keypoints;
 
-        m_homography_ransac->set_dataset(m_first_frame->feature->keypoints, pframe->feature->keypoints, matches);
-        m_homography_ransac->run();
-        matches.swap(m_homography_ransac->matches);
+        // both models see every match, the homography on a pool thread meanwhile
+        std::future<void> homography = m_ransac_pool->submit([&]() {
+            m_homography_ransac->set_dataset(pa, pb, matches);
+            m_homography_ransac->set_quality(quality);
+            m_homography_ransac->run();
+        });
 
-        m_triangulator->set_dataset(m_first_frame->feature->keypoints, pframe->feature->keypoints, matches);
-        m_triangulator->run(m_essential_ransac->E);
+        real essential_score = m_essential_ransac->estimate(pa, pb, matches, quality);
+        homography.get();
+
+        // R_H of ORB-SLAM: a plane or little parallax explains the matches about as well by H
+        real homography_score = m_homography_ransac->score;
+        bool planar = homography_score > 0 && homography_score / (homography_score + essential_score) > m_homography_ratio;
+
+        if (planar) {
+            matches.swap(m_homography_ransac->matches);
+            m_triangulator->set_dataset(pa, pb, matches);
+            m_triangulator->run_planar(m_homography_ransac->H);
+        }
+        else {
+            matches.swap(m_essential_ransac->matches);
+            m_triangulator->set_dataset(pa, pb, matches);
+            m_triangulator->run(m_essential_ransac->E);
+        }
         matches.swap(m_triangulator->matches);
 
         real angle = acos(m_triangulator->parallax) * 180 / 3.1415927f;
@@ -74,9 +95,8 @@ bool LazyPairInitializer::initialize(const std::shared_ptr<Frame> &pframe) {
         real wy = m_K(1, 2) * 0.25f;
         std::unordered_set<int> grid;
         for (auto &m : matches) {
-            auto &pt = pframe->feature->keypoints[m.second];
-            int ix = (int)((pt[0] * m_K(0, 0)) / wx + 5);
-            int iy = (int)((pt[1] * m_K(1, 1)) / wy + 5);
+            int ix = (int)((pframe->feature->keypoints.x[m.second] * m_K(0, 0)) / wx + 5);
+            int iy = (int)((pframe->feature->keypoints.y[m.second] * m_K(1, 1)) / wy + 5);
             grid.emplace(ix + iy * 100);
         }
 
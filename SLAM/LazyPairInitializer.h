@@ -5,9 +5,10 @@
 
 namespace slam {
 
-    class EightPointEssentialRANSAC;
+    class EssentialRANSAC;
     class FourPointHomographyRANSAC;
     class Triangulator;
+    class ThreadPool;
     class Frame;
     class Config;
 
@@ -23,11 +24,13 @@ namespace slam {
 
     private:
         real m_min_parallax;
+        real m_homography_ratio; // of homography over total score above which the scene counts as planar
         mat3 m_K;
 
         std::shared_ptr<Frame> m_first_frame;
         size_t m_frame_count = 0;
-        std::unique_ptr<EightPointEssentialRANSAC> m_essential_ransac;
+        std::unique_ptr<ThreadPool> m_ransac_pool;
+        std::unique_ptr<EssentialRANSAC> m_essential_ransac;
         std::unique_ptr<FourPointHomographyRANSAC> m_homography_ransac;
         std::unique_ptr<Triangulator> m_triangulator;
     };
@@ -14,15 +14,31 @@ namespace slam {
 
         virtual void clear() = 0;
 
-        virtual size_t add_keyframe(const std::shared_ptr<Frame> &pframe) = 0;
-        virtual size_t add_landmark(const vec3 &point) = 0;
+        virtual index_t add_keyframe(const std::shared_ptr<Frame> &pframe) = 0;
+        virtual index_t add_landmark(const vec3 &point) = 0;
 
-        virtual void add_observation(size_t keyframe, size_t landmark, const vec2 &x) = 0;
+        virtual void add_observation(index_t keyframe, index_t landmark, const vec2 &x) = 0;
 
         virtual bool init(const std::shared_ptr<Frame> &current_frame, const Initializer *initializer) = 0;
 
         virtual bool localize(const std::shared_ptr<Frame> &pframe) = 0;
 
+        /*
+        Pose of a frame from tracked points alone, tracks pair landmark ids with indices into points.
+        On success tracks keeps the inliers. Fails when the pose is unreliable or the frame
+        should become a keyframe, then the frame has to go through localize.
+        */
+        virtual bool localize_tracks(const KeypointArray &points, match_vector &tracks, mat3 &R, vec3 &T) = 0;
+
+        // Recover the pose of pframe in the existing map after tracking was lost.
+        virtual bool relocalize(const std::shared_ptr<Frame> &pframe) = 0;
+
+        // Global bundle adjustment over every keyframe and landmark, its cost grows with the map.
+        virtual bool optimize() = 0;
+
+        // Wall clock seconds each pose estimate of the calls above may take from now on, 0 for no limit.
+        virtual void set_time_budget(double seconds) = 0;
+
     };
 
 }
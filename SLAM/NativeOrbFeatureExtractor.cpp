@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include "Config.h"
+#include "FastDetector.h"
+#include "NativeOrbFeatureExtractor.h"
+#include "OcvOrbFeature.h"
+#include "OcvImage.h"
+#include "OcvImage_Impl.h"
+#include "ThreadPool.h"
+
+using namespace slam;
+
+// Radius of the orientation disc and of the square BRIEF patch.
+static const int half_patch_size = 15;
+
+/*
+256 point pairs drawn from an isotropic Gaussian with sigma = patch size / 5 (BRIEF G II),
+clipped to the patch. Box-Muller on raw mt19937 output so every platform gets the same
+pattern and descriptors stay comparable with a stored vocabulary.
+*/
+static std::vector<float> brief_pattern() {
+    std::mt19937 generator(0x4f524231);
+    auto uniform = [&generator]() { return (generator() + 0.5) / 4294967296.0; };
+    auto coordinate = [&uniform]() {
+        const double sigma = (2 * half_patch_size + 1) / 5.0;
+        for (;;) {
+            double z = std::sqrt(-2.0 * std::log(uniform())) * std::cos(2.0 * 3.14159265358979323846 * uniform());
+            double c = std::floor(z * sigma + 0.5);
+            if (std::abs(c) <= half_patch_size) {
+                return (float)c;
+            }
+        }
+    };
+
+    std::vector<float> pattern;
+    pattern.reserve(descriptor_bytes * 8 * 4);
+    while (pattern.size() < descriptor_bytes * 8 * 4) {
+        float x0 = coordinate(), y0 = coordinate(), x1 = coordinate(), y1 = coordinate();
+        if (x0 != x1 || y0 != y1) {
+            pattern.insert(pattern.end(), { x0, y0, x1, y1 });
+        }
+    }
+    return pattern;
+}
+
+// Angle of the vector from center to the intensity centroid of the disc around it.
+static float intensity_angle(const std::uint8_t *center, int stride, const std::vector<int> &umax) {
+    int m01 = 0, m10 = 0;
+    for (int u = -half_patch_size; u <= half_patch_size; ++u) {
+        m10 += u * center[u];
+    }
+    // rows above and below the center together
+    for (int v = 1; v <= half_patch_size; ++v) {
+        int v_sum = 0;
+        int d = umax[v];
+        for (int u = -d; u <= d; ++u) {
+            int below = center[u + v * stride], above = center[u - v * stride];
+            v_sum += below - above;
+            m10 += u * (below + above);
+        }
+        m01 += v * v_sum;
+    }
+    return std::atan2((float)m01, (float)m10);
+}
+
+static void steered_brief(const std::uint8_t *center, int stride, const float *pattern, float angle, std::uint8_t *descriptor) {
+    float c = std::cos(angle), s = std::sin(angle);
+    for (size_t i = 0; i < descriptor_bytes; ++i) {
+        std::uint8_t byte = 0;
+        for (int j = 0; j < 8; ++j, pattern += 4) {
+            int ax = (int)std::floor(pattern[0] * c - pattern[1] * s + 0.5f);
+            int ay = (int)std::floor(pattern[0] * s + pattern[1] * c + 0.5f);
+            int bx = (int)std::floor(pattern[2] * c - pattern[3] * s + 0.5f);
+            int by = (int)std::floor(pattern[2] * s + pattern[3] * c + 0.5f);
+            byte |= (std::uint8_t)((center[ay * stride + ax] < center[by * stride + bx]) << j);
+        }
+        descriptor[i] = byte;
+    }
+}
+
+NativeOrbFeatureExtractor::NativeOrbFeatureExtractor(const Config *config) {
+    m_pool = std::make_unique<ThreadPool>((size_t)config->value("FAST.threads", 0));
+    m_spread_size = (int)config->value("FAST.spread", 20);
+    m_nlevels = std::max((int)config->value("ORB.nlevels", 8), 1);
+    m_scale = (float)config->value("ORB.scaleFactor", 1.2);
+    for (int l = 0; l < m_nlevels; ++l) {
+        m_detectors.push_back(std::make_unique<TiledFastDetector>(m_pool.get(), m_spread_size,
+            (int)config->value("FAST.tileCells", 4),
+            (int)config->value("FAST.threshold", 10),
+            (int)config->value("FAST.minThreshold", 7),
+            (int)config->value("FAST.maxThreshold", 80)
+        ));
+    }
+    m_pattern = brief_pattern();
+
+    m_umax.resize(half_patch_size + 1);
+    for (int v = 0; v <= half_patch_size; ++v) {
+        m_umax[v] = (int)std::floor(std::sqrt((double)half_patch_size * half_patch_size - v * v) + 0.5);
+    }
+
+    // a rotated pattern reaches half_patch_size * sqrt(2) from the center
+    m_border = std::max((int)config->value("ORB.edgeThreshold", 31), (int)std::ceil(half_patch_size * std::sqrt(2.0)) + 1);
+    m_upright = config->value("ORB.upright", 0) != 0;
+    m_K = config->K;
+}
+
+NativeOrbFeatureExtractor::~NativeOrbFeatureExtractor() = default;
+
+std::unique_ptr<Feature> NativeOrbFeatureExtractor::extract(const Image *image) const {
+    const OcvImage *cvimage = dynamic_cast<const OcvImage *>(image);
+    if (cvimage == nullptr || !cvimage->valid()) {
+        return nullptr; // cannot extract on other image type;
+    }
+
+    // BRIEF compares smoothed pixels, as cv::ORB does
+    const OcvImagePyramid &pyramid = cvimage->m_pimpl->pyramid(m_nlevels, m_scale, true);
+
+    // corners of every level, in level pixel coordinates
+    std::vector<std::vector<Corner>> level_corners(m_nlevels);
+    const int border = m_border;
+    m_pool->parallel_for((size_t)m_nlevels, [&](size_t l) {
+        const cv::Mat &level = pyramid.levels[l];
+        const int width = level.cols, height = level.rows;
+        m_detectors[l]->detect(width, height, [&](int x0, int y0, int x1, int y1, int threshold, std::vector<Corner> &detected) {
+            // corners too close to the border have no full descriptor patch
+            fast9_detect(level.data, level.step, width, height,
+                std::max(x0, border), std::max(y0, border), std::min(x1, width - border), std::min(y1, height - border),
+                threshold, detected);
+        }, level_corners[l]);
+    });
+
+    std::vector<std::pair<int, size_t>> order; // (level, corner) of every output keypoint
+    for (int l = 0; l < m_nlevels; ++l) {
+        for (size_t k = 0; k < level_corners[l].size(); ++k) {
+            order.emplace_back(l, k);
+        }
+    }
+
+    std::unique_ptr<OcvOrbFeature> result = std::make_unique<OcvOrbFeature>();
+    result->m_descriptors.resize(order.size());
+    result->keypoints.resize(order.size());
+
+    const size_t chunk = 64;
+    m_pool->parallel_for((order.size() + chunk - 1) / chunk, [&](size_t c) {
+        size_t end = std::min(order.size(), (c + 1) * chunk);
+        for (size_t i = c * chunk; i < end; ++i) {
+            int l = order[i].first;
+            const Corner &corner = level_corners[l][order[i].second];
+            const cv::Mat &level = pyramid.levels[l], &blurred = pyramid.blurred[l];
+            int x = (int)corner.x, y = (int)corner.y;
+            float angle = m_upright ? 0.0f : intensity_angle(level.data + (size_t)y*level.step + x, (int)level.step, m_umax);
+            steered_brief(blurred.data + (size_t)y*blurred.step + x, (int)blurred.step, m_pattern.data(), angle, result->m_descriptors[i]);
+
+            float level_scale = std::pow(m_scale, (float)l);
+            result->keypoints.x[i] = (corner.x * level_scale - m_K(0, 2)) / m_K(0, 0);
+            result->keypoints.y[i] = (corner.y * level_scale - m_K(1, 2)) / m_K(1, 1);
+        }
+    });
+
+    result->m_grid.build(result->keypoints, m_spread_size / m_K(0, 0));
+
+    return result;
+}
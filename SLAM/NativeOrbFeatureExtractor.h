@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Types.h"
+#include "Feature.h"
+
+namespace slam {
+
+    class Config;
+    class ThreadPool;
+    class TiledFastDetector;
+
+    /*
+    ORB without going through cv::ORB: own FAST-9 detection, intensity centroid
+    orientation and steered BRIEF, computed in one pass per keypoint on the thread pool.
+    Every level of the image's cached pyramid is used.
+    Upright mode skips orientation and samples BRIEF unrotated.
+    Produces OcvOrbFeature so matching, vocabulary and map code stay the same.
+    */
+    class NativeOrbFeatureExtractor : public FeatureExtractor {
+    public:
+        NativeOrbFeatureExtractor(const Config *config);
+        ~NativeOrbFeatureExtractor();
+
+        std::unique_ptr<Feature> extract(const Image *image) const override;
+
+    private:
+        std::unique_ptr<ThreadPool> m_pool;
+        std::vector<std::unique_ptr<TiledFastDetector>> m_detectors; // one per pyramid level
+        std::vector<float> m_pattern; // BRIEF point pairs as x0, y0, x1, y1
+        std::vector<int> m_umax;      // half width of the orientation disc per row
+        mat3 m_K;
+        int m_spread_size;
+        int m_nlevels;
+        float m_scale;
+        int m_border;
+        bool m_upright;
+    };
+
+}
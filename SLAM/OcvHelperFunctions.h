@@ -57,8 +57,8 @@ namespace slam {
             }
             std::vector<cv::KeyPoint> cvkeypoints(ocvfeature->keypoints.size());
             for (size_t i = 0; i < ocvfeature->keypoints.size(); ++i) {
-                cvkeypoints[i].pt.x = ocvfeature->keypoints[i][0] * K(0, 0) + K(0, 2);
-                cvkeypoints[i].pt.y = ocvfeature->keypoints[i][1] * K(1, 1) + K(1, 2);
+                cvkeypoints[i].pt.x = ocvfeature->keypoints.x[i] * K(0, 0) + K(0, 2);
+                cvkeypoints[i].pt.y = ocvfeature->keypoints.y[i] * K(1, 1) + K(1, 2);
             }
 
             cv::Mat img;
@@ -81,12 +81,12 @@ namespace slam {
             std::vector<cv::KeyPoint> cvkeypoints_target(ocvfeature_target->keypoints.size());
 
             for (size_t i = 0; i < ocvfeature_source->keypoints.size(); ++i) {
-                cvkeypoints_source[i].pt.x = ocvfeature_source->keypoints[i][0] * K(0, 0) + K(0, 2);
-                cvkeypoints_source[i].pt.y = ocvfeature_source->keypoints[i][1] * K(1, 1) + K(1, 2);
+                cvkeypoints_source[i].pt.x = ocvfeature_source->keypoints.x[i] * K(0, 0) + K(0, 2);
+                cvkeypoints_source[i].pt.y = ocvfeature_source->keypoints.y[i] * K(1, 1) + K(1, 2);
             }
             for (size_t i = 0; i < ocvfeature_target->keypoints.size(); ++i) {
-                cvkeypoints_target[i].pt.x = ocvfeature_target->keypoints[i][0] * K(0, 0) + K(0, 2);
-                cvkeypoints_target[i].pt.y = ocvfeature_target->keypoints[i][1] * K(1, 1) + K(1, 2);
+                cvkeypoints_target[i].pt.x = ocvfeature_target->keypoints.x[i] * K(0, 0) + K(0, 2);
+                cvkeypoints_target[i].pt.y = ocvfeature_target->keypoints.y[i] * K(1, 1) + K(1, 2);
             }
 
             std::vector<cv::DMatch> cvmatches(matches.size());
@@ -120,12 +120,12 @@ namespace slam {
             std::vector<cv::KeyPoint> cvkeypoints_target(ocvfeature_target->keypoints.size());
 
             for (size_t i = 0; i < ocvfeature_source->keypoints.size(); ++i) {
-                cvkeypoints_source[i].pt.x = ocvfeature_source->keypoints[i][0] * K(0, 0) + K(0, 2);
-                cvkeypoints_source[i].pt.y = ocvfeature_source->keypoints[i][1] * K(1, 1) + K(1, 2);
+                cvkeypoints_source[i].pt.x = ocvfeature_source->keypoints.x[i] * K(0, 0) + K(0, 2);
+                cvkeypoints_source[i].pt.y = ocvfeature_source->keypoints.y[i] * K(1, 1) + K(1, 2);
             }
             for (size_t i = 0; i < ocvfeature_target->keypoints.size(); ++i) {
-                cvkeypoints_target[i].pt.x = ocvfeature_target->keypoints[i][0] * K(0, 0) + K(0, 2);
-                cvkeypoints_target[i].pt.y = ocvfeature_target->keypoints[i][1] * K(1, 1) + K(1, 2);
+                cvkeypoints_target[i].pt.x = ocvfeature_target->keypoints.x[i] * K(0, 0) + K(0, 2);
+                cvkeypoints_target[i].pt.y = ocvfeature_target->keypoints.y[i] * K(1, 1) + K(1, 2);
             }
 
             cv::Mat img;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "OcvImage.h"
 #include "OcvImage_Impl.h"
 
@@ -20,3 +21,36 @@ OcvImage::~OcvImage() = default;
 bool OcvImage::valid() const {
     return !(m_pimpl->image.empty());
 }
+
+const OcvImagePyramid &OcvImage_Impl::pyramid(int nlevels, float scale, bool blurred) {
+    std::lock_guard<std::mutex> lock(pyramid_mutex);
+    nlevels = std::max(nlevels, 1);
+
+    if ((int)pyramid_cache.levels.size() != nlevels || pyramid_cache.scale != scale) {
+        pyramid_cache.scale = scale;
+        pyramid_cache.levels.resize(nlevels);
+        pyramid_cache.blurred.clear();
+        if (image.channels() != 1) {
+            cv::cvtColor(image, pyramid_cache.levels[0], cv::COLOR_RGB2GRAY);
+        }
+        else {
+            pyramid_cache.levels[0] = image;
+        }
+        // each level is resized from the one above, as cv::ORB does
+        double level_scale = 1.0;
+        for (int l = 1; l < nlevels; ++l) {
+            level_scale *= scale;
+            cv::Size size(cvRound(image.cols / level_scale), cvRound(image.rows / level_scale));
+            cv::resize(pyramid_cache.levels[l - 1], pyramid_cache.levels[l], size, 0, 0, cv::INTER_LINEAR);
+        }
+    }
+
+    if (blurred && pyramid_cache.blurred.empty()) {
+        pyramid_cache.blurred.resize(nlevels);
+        for (int l = 0; l < nlevels; ++l) {
+            cv::GaussianBlur(pyramid_cache.levels[l], pyramid_cache.blurred[l], cv::Size(7, 7), 2, 2, cv::BORDER_REFLECT_101);
+        }
+    }
+
+    return pyramid_cache;
+}
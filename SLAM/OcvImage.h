@@ -20,6 +20,8 @@ namespace slam {
 
     private:
         friend class OcvOrbFeatureExtractor;
+        friend class NativeOrbFeatureExtractor;
+        friend class OcvLKTracker;
         friend class OcvCameraImageStream;
         std::unique_ptr<OcvImage_Impl> m_pimpl;
     };
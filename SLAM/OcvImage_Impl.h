@@ -1,11 +1,32 @@
 #pragma once
 
+#include <mutex>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
 namespace slam {
 
+    /*
+    Grayscale pyramid, level l is the image downscaled by scale^l.
+    blurred holds the levels smoothed for BRIEF sampling, empty unless asked for.
+    */
+    struct OcvImagePyramid {
+        float scale = 0.0f;
+        std::vector<cv::Mat> levels;
+        std::vector<cv::Mat> blurred;
+    };
+
     struct OcvImage_Impl {
         cv::Mat image;
+
+        /*
+        Pyramid of image, built on first use and shared by everything working on this image.
+        A request with other level count or scale rebuilds it.
+        */
+        const OcvImagePyramid &pyramid(int nlevels, float scale, bool blurred = false);
+
+        std::mutex pyramid_mutex;
+        OcvImagePyramid pyramid_cache;
     };
 
 }
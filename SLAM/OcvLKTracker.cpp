@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Config.h"
+#include "OcvLKTracker.h"
+#include "OcvImage.h"
+#include "OcvImage_Impl.h"
+
+namespace slam {
+
+    struct OcvLKTracker_Impl {
+        OcvImagePyramid reference; // shares the levels with the reference image
+    };
+
+}
+
+using namespace slam;
+
+static const int window_radius = 10;
+static const int max_iterations = 30;
+static const float min_step = 0.01f;       // pixels
+static const float min_eigenvalue = 1.0f;  // of the gradient matrix, per window pixel
+static const float max_residual = 20.0f;   // mean absolute intensity difference
+
+/*
+Bilinear samples of the (2 radius + 1)^2 window centered at (x, y), row by row.
+Pixels outside the image repeat the border.
+*/
+static void sample_window(const cv::Mat &image, float x, float y, int radius, float *window) {
+    int ix = (int)std::floor(x), iy = (int)std::floor(y);
+    float fx = x - ix, fy = y - iy;
+    float w00 = (1 - fx)*(1 - fy), w01 = fx*(1 - fy), w10 = (1 - fx)*fy, w11 = fx*fy;
+    int max_x = image.cols - 1, max_y = image.rows - 1;
+    for (int v = -radius; v <= radius; ++v) {
+        const unsigned char *r0 = image.ptr(std::min(std::max(iy + v, 0), max_y));
+        const unsigned char *r1 = image.ptr(std::min(std::max(iy + v + 1, 0), max_y));
+        for (int u = -radius; u <= radius; ++u) {
+            int x0 = std::min(std::max(ix + u, 0), max_x);
+            int x1 = std::min(std::max(ix + u + 1, 0), max_x);
+            *window++ = w00*r0[x0] + w01*r0[x1] + w10*r1[x0] + w11*r1[x1];
+        }
+    }
+}
+
+/*
+Refine the displacement d of the window at p from the reference level I to the level J.
+Returns false, leaving d alone, if the window has no texture to track.
+*/
+static bool track_level(const cv::Mat &I, const cv::Mat &J, const vec2 &p, vec2 &d, float &residual) {
+    const int size = 2 * window_radius + 1;
+    const int outer = size + 2;
+    float reference[(2 * window_radius + 3)*(2 * window_radius + 3)];
+    float ix[(2 * window_radius + 1)*(2 * window_radius + 1)];
+    float iy[(2 * window_radius + 1)*(2 * window_radius + 1)];
+    float target[(2 * window_radius + 1)*(2 * window_radius + 1)];
+
+    // reference window with a one pixel margin for the central differences
+    sample_window(I, p.x(), p.y(), window_radius + 1, reference);
+    float gxx = 0, gxy = 0, gyy = 0;
+    for (int v = 0; v < size; ++v) {
+        const float *r = reference + (v + 1)*outer + 1;
+        for (int u = 0; u < size; ++u) {
+            float dx = 0.5f*(r[u + 1] - r[u - 1]);
+            float dy = 0.5f*(r[u + outer] - r[u - outer]);
+            ix[v*size + u] = dx;
+            iy[v*size + u] = dy;
+            gxx += dx*dx;
+            gxy += dx*dy;
+            gyy += dy*dy;
+        }
+    }
+
+    float det = gxx*gyy - gxy*gxy;
+    float eigenvalue = 0.5f*(gxx + gyy - std::sqrt((gxx - gyy)*(gxx - gyy) + 4 * gxy*gxy));
+    if (eigenvalue < min_eigenvalue*size*size || det <= 0) {
+        return false;
+    }
+
+    for (int iteration = 0; iteration < max_iterations; ++iteration) {
+        sample_window(J, p.x() + d.x(), p.y() + d.y(), window_radius, target);
+        float bx = 0, by = 0;
+        residual = 0;
+        for (int v = 0; v < size; ++v) {
+            const float *r = reference + (v + 1)*outer + 1;
+            for (int u = 0; u < size; ++u) {
+                float e = r[u] - target[v*size + u];
+                bx += e*ix[v*size + u];
+                by += e*iy[v*size + u];
+                residual += std::abs(e);
+            }
+        }
+        residual /= size*size;
+
+        vec2 step((gyy*bx - gxy*by) / det, (gxx*by - gxy*bx) / det);
+        d += step;
+        if (step.squaredNorm() < min_step*min_step) {
+            break;
+        }
+    }
+    return true;
+}
+
+OcvLKTracker::OcvLKTracker(const Config *config) {
+    m_pimpl = std::make_unique<OcvLKTracker_Impl>();
+    m_K = config->K;
+    // same pyramid as the feature extractors, so whichever runs first builds it for all
+    m_nlevels = std::max((int)config->value("ORB.nlevels", 8), 1);
+    m_scale = (float)config->value("ORB.scaleFactor", 1.2);
+}
+
+OcvLKTracker::~OcvLKTracker() = default;
+
+void OcvLKTracker::set_reference(const Image *image) {
+    const OcvImage *cvimage = dynamic_cast<const OcvImage *>(image);
+    if (cvimage == nullptr || !cvimage->valid()) {
+        m_pimpl->reference = OcvImagePyramid();
+        return;
+    }
+    m_pimpl->reference = cvimage->m_pimpl->pyramid(m_nlevels, m_scale);
+}
+
+void OcvLKTracker::track(const Image *image, const KeypointArray &reference_points, KeypointArray &tracked_points, std::vector<bool> &status) {
+    tracked_points.resize(reference_points.size());
+    status.assign(reference_points.size(), false);
+
+    const OcvImage *cvimage = dynamic_cast<const OcvImage *>(image);
+    if (cvimage == nullptr || !cvimage->valid()) {
+        return;
+    }
+    OcvImagePyramid current = cvimage->m_pimpl->pyramid(m_nlevels, m_scale);
+    OcvImagePyramid reference = std::move(m_pimpl->reference);
+    m_pimpl->reference = current;
+    if (reference.levels.size() != current.levels.size() || reference.levels[0].cols != current.levels[0].cols || reference.levels[0].rows != current.levels[0].rows) {
+        return;
+    }
+
+    const int nlevels = (int)current.levels.size();
+    const float width = (float)current.levels[0].cols, height = (float)current.levels[0].rows;
+    for (size_t i = 0; i < reference_points.size(); ++i) {
+        vec2 p0(reference_points.x[i] * m_K(0, 0) + m_K(0, 2), reference_points.y[i] * m_K(1, 1) + m_K(1, 2));
+
+        // coarse to fine, the displacement found on a level seeds the next finer one;
+        // coarse levels without texture are passed through, only the base level must track
+        vec2 d(0, 0);
+        float residual = 0;
+        bool tracked = false;
+        for (int l = nlevels - 1; l >= 0; --l) {
+            float level_scale = std::pow(m_scale, (float)l);
+            tracked = track_level(reference.levels[l], current.levels[l], p0 / level_scale, d, residual);
+            if (l > 0) {
+                d *= m_scale;
+            }
+        }
+
+        vec2 p1 = p0 + d;
+        if (!tracked || residual > max_residual || !(p1.x() >= 0 && p1.x() < width && p1.y() >= 0 && p1.y() < height)) {
+            continue;
+        }
+        tracked_points.x[i] = (p1.x() - m_K(0, 2)) / m_K(0, 0);
+        tracked_points.y[i] = (p1.y() - m_K(1, 2)) / m_K(1, 1);
+        status[i] = true;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include "Types.h"
+#include "PointTracker.h"
+
+namespace slam {
+
+    class Config;
+    struct OcvLKTracker_Impl;
+
+    /*
+    Pyramidal Lucas-Kanade on the image pyramid that OcvImage caches for feature
+    extraction, so tracking a frame builds no pyramid of its own.
+    */
+    class OcvLKTracker : public PointTracker {
+    public:
+        OcvLKTracker(const Config *config);
+        ~OcvLKTracker();
+
+        void set_reference(const Image *image) override;
+
+        void track(const Image *image, const KeypointArray &reference_points, KeypointArray &tracked_points, std::vector<bool> &status) override;
+
+    private:
+        std::unique_ptr<OcvLKTracker_Impl> m_pimpl;
+        mat3 m_K;
+        int m_nlevels;
+        float m_scale;
+    };
+
+}
@@ -1,5 +1,8 @@
-#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include "Config.h"
+#include "FastDetector.h"
 #include "OcvOrbFeature.h"
 #include "OcvOrbFeature_Impl.h"
 #include "OcvImage.h"
@@ -7,13 +10,22 @@
 
 using namespace slam;
 
-OcvOrbFeature::OcvOrbFeature() {
-    m_pimpl = std::make_unique<OcvOrbFeature_Impl>();
-}
+OcvOrbFeature::OcvOrbFeature() = default;
 
 OcvOrbFeature::~OcvOrbFeature() = default;
 
-match_vector OcvOrbFeature::match(const Feature *feature, size_t k, real radius) const {
+const DescriptorArray *OcvOrbFeature::descriptors() const {
+    return &m_descriptors;
+}
+
+// Descriptors further apart than this are never reported as matches.
+static const std::uint32_t max_hamming_distance = 80;
+
+match_vector OcvOrbFeature::match(const Feature *feature, real radius, const KeypointArray *predictions, std::vector<real> *quality) const {
+    if (quality) {
+        quality->clear();
+    }
+
     const OcvOrbFeature *cvfeature = dynamic_cast<const OcvOrbFeature*>(feature);
     if (cvfeature == nullptr) {
         return match_vector();
@@ -23,77 +35,53 @@ match_vector OcvOrbFeature::match(const Feature *feature, size_t k, real radius)
         return match_vector();
     }
 
-    real radius2 = radius*radius;
-
-    cv::BFMatcher matcher(cv::NORM_HAMMING, false);
-#if 1
-    std::vector<std::vector<cv::DMatch>> cvknnresult;
-    matcher.knnMatch(m_pimpl->descriptors, cvfeature->m_pimpl->descriptors, cvknnresult, (int)k);
+    const DescriptorArray &train = cvfeature->m_descriptors;
 
     match_vector result;
-    result.reserve(cvknnresult.size());
-    for (size_t i = 0; i < cvknnresult.size(); ++i) {
-        for (size_t j = 0; j < cvknnresult[i].size(); ++j) {
-            if ((cvfeature->keypoints[cvknnresult[i][j].trainIdx] - keypoints[cvknnresult[i][j].queryIdx]).squaredNorm() < radius2) {
-                result.emplace_back(cvknnresult[i][j].queryIdx, cvknnresult[i][j].trainIdx);
-                break;
-            }
+    result.reserve(keypoints.size());
+
+    // only the target keypoints bucketed near the search center are compared
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+        vec2 center = predictions ? (*predictions)[i] : keypoints[i];
+        candidates.clear();
+        cvfeature->m_grid.query(center, radius, candidates);
+        if (candidates.empty()) {
+            continue;
         }
-    }
-    result.shrink_to_fit();
-#else
-    std::vector<cv::DMatch> cvresult;
-    matcher.match(m_pimpl->descriptors, cvfeature->m_pimpl->descriptors, cvresult);
-
-    match_vector result(cvresult.size());
-    for (size_t i = 0; i < cvresult.size(); ++i) {
-        result[i].first = cvresult[i].queryIdx;
-        result[i].second = cvresult[i].trainIdx;
-    }
-#endif
-    return result;
-}
 
-static void spread_keypoints(std::vector<cv::KeyPoint> &cvkeypoints, int grid_size = 10) {
-    union Hasher {
-        struct {
-            std::int16_t x;
-            std::int16_t y;
-        } fields;
-        std::int32_t hash;
-    } hasher;
-    std::unordered_map<std::int32_t, cv::KeyPoint> grid;
-    for (auto &key : cvkeypoints) {
-        hasher.fields.x = (std::int16_t)(key.pt.x / grid_size);
-        hasher.fields.y = (std::int16_t)(key.pt.y / grid_size);
-        int hash = hasher.hash;
-        if (grid.count(hash)) {
-            if (grid.at(hash).response < key.response) {
-                grid.at(hash) = key;
+        HammingMatch best;
+        hamming_knn(m_descriptors[i], train.data(), candidates.data(), candidates.size(), 1, &best);
+        if (best.distance <= max_hamming_distance) {
+            result.emplace_back((index_t)i, (index_t)best.index);
+            if (quality) {
+                quality->push_back(1.0f - best.distance / (real)(8 * descriptor_bytes));
             }
         }
-        else {
-            grid[hash] = key;
-        }
-    }
-    cvkeypoints.resize(grid.size());
-    size_t id = 0;
-    for (auto &key : grid) {
-        cvkeypoints[id] = key.second;
-        id++;
     }
+    result.shrink_to_fit();
+
+    return result;
 }
 
 OcvOrbFeatureExtractor::OcvOrbFeatureExtractor(const Config *config) {
     m_pimpl = std::make_unique<OcvOrbFeatureExtractor_Impl>();
-    m_pimpl->fast = cv::FastFeatureDetector::create((int)config->value("FAST.threshold", 10), true);
-    m_pimpl->orb = cv::ORB::create(0,
-        (float)config->value("ORB.scaleFactor", 1.2),
-        (int)config->value("ORB.nlevels", 8),
-        (int)config->value("ORB.edgeThreshold", 31)
-    );
+    m_pimpl->pool = std::make_unique<ThreadPool>((size_t)config->value("FAST.threads", 0));
     m_K = config->K;
     m_spread_size = (int)config->value("FAST.spread", 20);
+    m_nlevels = std::max((int)config->value("ORB.nlevels", 8), 1);
+    m_scale = (float)config->value("ORB.scaleFactor", 1.2);
+
+    // levels come from the image pyramid, cv::ORB only describes one level at a time
+    for (int l = 0; l < m_nlevels; ++l) {
+        m_pimpl->orbs.push_back(cv::ORB::create(0, m_scale, 1, (int)config->value("ORB.edgeThreshold", 31)));
+        m_pimpl->detectors.push_back(std::make_unique<TiledFastDetector>(m_pimpl->pool.get(), m_spread_size,
+            (int)config->value("FAST.tileCells", 4),
+            (int)config->value("FAST.threshold", 10),
+            (int)config->value("FAST.minThreshold", 7),
+            (int)config->value("FAST.maxThreshold", 80)
+        ));
+    }
 }
 
 OcvOrbFeatureExtractor::~OcvOrbFeatureExtractor() = default;
@@ -104,21 +92,56 @@ std::unique_ptr<Feature> OcvOrbFeatureExtractor::extract(const Image *image) con
         return nullptr; // cannot extract on other image type;
     }
 
-    const cv::Mat &cvmat = cvimage->m_pimpl->image;
-    std::vector<cv::KeyPoint> cvkeypoints;
+    const OcvImagePyramid &pyramid = cvimage->m_pimpl->pyramid(m_nlevels, m_scale);
+    std::vector<std::vector<cv::KeyPoint>> level_keypoints(m_nlevels);
+    std::vector<cv::Mat> level_descriptors(m_nlevels);
     std::unique_ptr<OcvOrbFeature> result = std::make_unique<OcvOrbFeature>();
 
-    m_pimpl->fast->detect(cvmat, cvkeypoints);
-
-    spread_keypoints(cvkeypoints, m_spread_size);
+    m_pimpl->pool->parallel_for((size_t)m_nlevels, [&](size_t l) {
+        const cv::Mat &level = pyramid.levels[l];
+        std::vector<Corner> corners;
+        m_pimpl->detectors[l]->detect(level.cols, level.rows, [&level](int x0, int y0, int x1, int y1, int threshold, std::vector<Corner> &detected) {
+            const int border = 4; // FAST circle radius plus the non-maximum suppression neighbourhood
+            int bx0 = std::max(x0 - border, 0);
+            int by0 = std::max(y0 - border, 0);
+            int bx1 = std::min(x1 + border, level.cols);
+            int by1 = std::min(y1 + border, level.rows);
+            std::vector<cv::KeyPoint> roi_keypoints;
+            cv::FAST(level(cv::Rect(bx0, by0, bx1 - bx0, by1 - by0)), roi_keypoints, threshold, true);
+            for (auto &key : roi_keypoints) {
+                float x = key.pt.x + bx0, y = key.pt.y + by0;
+                if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+                    detected.push_back(Corner{ x, y, key.response });
+                }
+            }
+        }, corners);
 
-    m_pimpl->orb->compute(cvmat, cvkeypoints, result->m_pimpl->descriptors);
+        std::vector<cv::KeyPoint> &cvkeypoints = level_keypoints[l];
+        cvkeypoints.reserve(corners.size());
+        for (auto &corner : corners) {
+            cvkeypoints.emplace_back(cv::Point2f(corner.x, corner.y), 7.0f, -1.0f, corner.response);
+        }
+        m_pimpl->orbs[l]->compute(level, cvkeypoints, level_descriptors[l]);
+    });
 
-    result->keypoints.resize(cvkeypoints.size());
-    for (size_t i = 0; i < cvkeypoints.size(); ++i) {
-        result->keypoints[i][0] = (cvkeypoints[i].pt.x - m_K(0, 2)) / m_K(0, 0);
-        result->keypoints[i][1] = (cvkeypoints[i].pt.y - m_K(1, 2)) / m_K(1, 1);
+    size_t count = 0;
+    for (auto &cvkeypoints : level_keypoints) {
+        count += cvkeypoints.size();
     }
+    result->m_descriptors.resize(count);
+    result->keypoints.resize(count);
+
+    size_t i = 0;
+    float level_scale = 1.0f;
+    for (int l = 0; l < m_nlevels; ++l, level_scale *= m_scale) {
+        for (size_t k = 0; k < level_keypoints[l].size(); ++k, ++i) {
+            memcpy(result->m_descriptors[i], level_descriptors[l].ptr((int)k), descriptor_bytes);
+            result->keypoints.x[i] = (level_keypoints[l][k].pt.x * level_scale - m_K(0, 2)) / m_K(0, 0);
+            result->keypoints.y[i] = (level_keypoints[l][k].pt.y * level_scale - m_K(1, 2)) / m_K(1, 1);
+        }
+    }
+
+    result->m_grid.build(result->keypoints, m_spread_size / m_K(0, 0));
 
     return result;
 }
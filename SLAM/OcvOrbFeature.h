@@ -3,22 +3,26 @@
 #include <memory>
 #include "Types.h"
 #include "Feature.h"
+#include "FeatureGrid.h"
+#include "Hamming.h"
 
 namespace slam {
 
-    struct OcvOrbFeature_Impl;
-
     class OcvOrbFeature : public Feature {
         friend struct OcvHelperFunctions;
     public:
         OcvOrbFeature();
         ~OcvOrbFeature();
 
-        match_vector match(const Feature *feature, size_t k = 5, real radius = 1.0e7f) const override;
+        match_vector match(const Feature *feature, real radius = 1.0e7f, const KeypointArray *predictions = nullptr, std::vector<real> *quality = nullptr) const override;
+
+        const DescriptorArray *descriptors() const override;
 
     private:
         friend class OcvOrbFeatureExtractor;
-        std::unique_ptr<OcvOrbFeature_Impl> m_pimpl;
+        friend class NativeOrbFeatureExtractor;
+        DescriptorArray m_descriptors;
+        FeatureGrid m_grid;
     };
 
     struct OcvOrbFeatureExtractor_Impl;
@@ -35,6 +39,8 @@ namespace slam {
         std::unique_ptr<OcvOrbFeatureExtractor_Impl> m_pimpl;
         mat3 m_K;
         int m_spread_size;
+        int m_nlevels;
+        float m_scale;
     };
 
 }
@@ -1,16 +1,18 @@
 #pragma once
 
+#include <memory>
+#include <vector>
 #include <opencv2/opencv.hpp>
+#include "FastDetector.h"
+#include "ThreadPool.h"
 
 namespace slam {
 
-    struct OcvOrbFeature_Impl {
-        cv::Mat descriptors;
-    };
-
     struct OcvOrbFeatureExtractor_Impl {
-        cv::Ptr<cv::Feature2D> fast;
-        cv::Ptr<cv::Feature2D> orb;
+        std::unique_ptr<ThreadPool> pool;
+        // one of each per pyramid level, levels are processed in parallel
+        std::vector<cv::Ptr<cv::Feature2D>> orbs;
+        std::vector<std::unique_ptr<TiledFastDetector>> detectors;
     };
 
 }
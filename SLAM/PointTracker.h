@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include "Types.h"
+
+namespace slam {
+
+    class Image;
+
+    /*
+    Follows points from one image to the next without extracting features.
+    Points are in normalized image coordinates, like Feature::keypoints.
+    */
+    class PointTracker {
+    public:
+        virtual ~PointTracker() {}
+
+        // Make image the reference that the next track() starts from.
+        virtual void set_reference(const Image *image) = 0;
+
+        /*
+        Find reference_points of the reference image in image, which then becomes the reference.
+        status[i] is false for points that were lost, their tracked_points are undefined.
+        */
+        virtual void track(const Image *image, const KeypointArray &reference_points, KeypointArray &tracked_points, std::vector<bool> &status) = 0;
+
+    };
+
+}
@@ -1,59 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "RANSAC.h"
-#include "Random.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
 
 using namespace slam;
 
-RANSAC::RANSAC(real success_rate, size_t max_iter)
-    : m_success_rate(success_rate), m_max_iter(max_iter), iter(0), score(0.0f)
-{}
+size_t slam::popcount(std::uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    return (size_t)__popcnt64(x);
+#elif defined(_MSC_VER) && defined(_M_IX86)
+    return (size_t)(__popcnt((unsigned int)x) + __popcnt((unsigned int)(x >> 32)));
+#elif defined(__GNUC__)
+    return (size_t)__builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (size_t)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
 
-RANSAC::~RANSAC() = default;
+size_t InlierMask::count() const {
+    size_t n = 0;
+    for (std::uint64_t w : m_words) {
+        n += popcount(w);
+    }
+    return n;
+}
 
-void RANSAC::run() {
-    size_t ds = data_size();
-    size_t ss = sample_size();
-    if (ds < ss) {
-        reset_model();
-        return;
+ProgressiveSampler::ProgressiveSampler(const std::vector<size_t> &order, size_t sample_size, unsigned int seed, double max_samples)
+    : m_order(order), m_m(sample_size), m_n(sample_size), m_T_n_prime(1) {
+    size_t N = m_order.size();
+    m_T_n = max_samples;
+    for (size_t i = 0; i < m_m; ++i) {
+        m_T_n *= (double)(m_n - i) / (N - i);
     }
+    m_dice.seed(seed);
+}
 
-    size_t iter_limit = m_max_iter;
+void ProgressiveSampler::draw(size_t t, size_t *sample_set) {
+    size_t N = m_order.size();
+    while (t > m_T_n_prime && m_n < N) {
+        double T_n_next = m_T_n * (m_n + 1) / (m_n + 1 - m_m);
+        m_T_n_prime += (size_t)std::ceil(T_n_next - m_T_n);
+        m_T_n = T_n_next;
+        ++m_n;
+    }
 
-    LotBox cards(ds);
-    std::vector<size_t> sample_set(ss);
+    size_t random_count = m_m;
+    size_t pool = m_n;
+    if (t <= m_T_n_prime) {
+        // the newest point of the set is always in the sample
+        sample_set[m_m - 1] = m_order[m_n - 1];
+        random_count--;
+        pool--;
+    }
 
-    size_t tmp_inlier_count = 0;
+    for (size_t k = 0; k < random_count; ++k) {
+        size_t index;
+        do {
+            index = m_order[m_dice.next(0, pool - 1)];
+        } while (std::find(sample_set, sample_set + k, index) != sample_set + k);
+        sample_set[k] = index;
+    }
+}
 
-    std::vector<bool> tmp_inlier_set(ds);
-    std::vector<bool> inlier_set(ds);
+SprtTest::SprtTest() : m_epsilon(0.1), m_delta(0.05), m_rejected_tested(0), m_rejected_consistent(0) {
+    update_threshold();
+}
 
-    real tmp_score = 0;
-    real score = 0;
+double SprtTest::threshold() const {
+    return std::exp(m_log_A);
+}
 
-    for (iter = 0; iter < iter_limit; ++iter) {
-        for (size_t k = 0; k < ss; ++k) {
-            sample_set[k] = cards.draw_without_replacement();
-        }
-        cards.refill_all();
+void SprtTest::model_rejected(size_t tested, size_t consistent) {
+    m_rejected_tested += tested;
+    m_rejected_consistent += consistent;
+    double delta = std::max((double)m_rejected_consistent / m_rejected_tested, 1.0e-4);
+    if (std::abs(delta - m_delta) > 0.1 * m_delta) {
+        m_delta = delta;
+        update_threshold();
+    }
+}
 
-        fit_model(sample_set);
+void SprtTest::best_model(real inlier_rate) {
+    if (inlier_rate > m_epsilon) {
+        m_epsilon = std::min((double)inlier_rate, 0.999);
+        update_threshold();
+    }
+}
 
-        tmp_score = eval_model(tmp_inlier_set, tmp_inlier_count);
+void SprtTest::update_threshold() {
+    if (m_epsilon <= m_delta) {
+        m_log_consistent = m_log_inconsistent = 0;
+        m_log_A = std::numeric_limits<double>::infinity();
+        return;
+    }
+    m_log_consistent = std::log(m_delta / m_epsilon);
+    m_log_inconsistent = std::log((1 - m_delta) / (1 - m_epsilon));
 
-        if (tmp_score > score) {
-            inlier_set.swap(tmp_inlier_set);
-            score = tmp_score;
-            iter_limit = calc_iter_limit(m_success_rate, tmp_inlier_count / (real)ds, ss);
-        }
+    // A = t_M C / m_S + 1 + log A, by fixed point iteration
+    const double model_cost = 200;   // fitting one model, in point evaluations
+    const double models_per_sample = 1;
+    double C = (1 - m_delta) * m_log_inconsistent + m_delta * m_log_consistent;
+    double K = model_cost * C / models_per_sample + 1;
+    double A = K;
+    for (int i = 0; i < 10; ++i) {
+        A = K + std::log(A);
     }
+    m_log_A = std::log(A);
+}
+
+unsigned int RANSACBase::derive_seed(unsigned int seed, unsigned int stream) {
+    std::seed_seq sequence{ seed, stream };
+    unsigned int result;
+    sequence.generate(&result, &result + 1);
+    return result;
+}
+
+RANSACBase::RANSACBase(real success_rate, size_t max_iter)
+    : iter(0), score(0.0f), confident(false), m_success_rate(success_rate), m_max_iter(max_iter), m_pool(nullptr), m_seed(0), m_lo_iterations(0), m_time_budget(0)
+{}
+
+RANSACBase::~RANSACBase() = default;
+
+void RANSACBase::set_quality(const std::vector<real> &quality) {
+    m_quality = quality;
+}
+
+void RANSACBase::set_thread_pool(ThreadPool *pool) {
+    m_pool = pool;
+}
+
+void RANSACBase::set_seed(unsigned int seed) {
+    m_seed = seed;
+}
+
+void RANSACBase::set_local_optimization(size_t inner_iterations) {
+    m_lo_iterations = inner_iterations;
+}
 
-    refine_model(inlier_set);
+void RANSACBase::set_time_budget(double seconds) {
+    m_time_budget = seconds;
 }
 
-size_t RANSAC::calc_iter_limit(real success_rate, real inlier_rate, size_t sample_size) {
+size_t RANSACBase::calc_iter_limit(real success_rate, real inlier_rate, size_t sample_size) {
     real N = std::log(1.0f - success_rate) / std::log(1.0f - std::pow(inlier_rate, (real)sample_size));
-    if (!std::isfinite(N)) {
+    if (!std::isfinite(N) || N > 1.0e9f) {
         N = 1.0e9f;
     }
-    return std::min((size_t)std::ceil(N), m_max_iter);
+    return (size_t)std::ceil(N);
 }
@@ -1,34 +1,490 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
 #include "Types.h"
+#include "Random.h"
+#include "ThreadPool.h"
 
 namespace slam {
 
-    class RANSAC {
+    /*
+    Inlier flags of a dataset, one bit per point packed into 64-bit words,
+    word w holds points [64 w, 64 w + 64). Bits past size() are always zero.
+    */
+    class InlierMask {
+    public:
+        static const size_t word_bits = 64;
+
+        void resize(size_t n) {
+            m_size = n;
+            m_words.assign((n + word_bits - 1) / word_bits, 0);
+        }
+
+        void clear() {
+            m_size = 0;
+            m_words.clear();
+        }
+
+        size_t size() const { return m_size; }
+
+        bool operator[](size_t i) const {
+            return ((m_words[i / word_bits] >> (i % word_bits)) & 1) != 0;
+        }
+
+        size_t word_count() const { return m_words.size(); }
+        std::uint64_t &word(size_t w) { return m_words[w]; }
+        std::uint64_t word(size_t w) const { return m_words[w]; }
+
+        // Number of set bits.
+        size_t count() const;
+
+        void swap(InlierMask &other) {
+            m_words.swap(other.m_words);
+            std::swap(m_size, other.m_size);
+        }
+
+    private:
+        std::vector<std::uint64_t> m_words;
+        size_t m_size = 0;
+    };
+
+    size_t popcount(std::uint64_t x);
+
+    /*
+    PROSAC sampling (Chum and Matas 2005). The t-th sample holds the n-th best point and
+    m - 1 others from the n - 1 best, n grows on the schedule that takes max_samples
+    draws to reach all points, after which sampling is uniform.
+    */
+    class ProgressiveSampler {
+    public:
+        // order lists the data indices best quality first and must outlive the sampler.
+        ProgressiveSampler(const std::vector<size_t> &order, size_t sample_size, unsigned int seed, double max_samples = 200000);
+
+        // Draw the t-th sample into sample_set[0, sample_size), t counts from 1 and must not decrease between calls.
+        void draw(size_t t, size_t *sample_set);
+
+    private:
+        const std::vector<size_t> &m_order;
+        size_t m_m;
+        size_t m_n;
+        double m_T_n;
+        size_t m_T_n_prime;
+        UniformInteger<size_t> m_dice;
+    };
+
+    /*
+    Wald's sequential probability ratio test for RANSAC (Matas and Chum 2008).
+    epsilon is the inlier ratio of a good model, taken from the best model so far;
+    delta the ratio of points consistent with a bad model, estimated from rejected ones.
+    A model is rejected as soon as the likelihood ratio of bad over good exceeds A.
+    */
+    class SprtTest {
+    public:
+        SprtTest();
+
+        // Rejection threshold of the likelihood ratio, infinite while the test cannot tell models apart.
+        double threshold() const;
+
+        // Whether a model with consistent out of tested points is already known to be bad.
+        bool reject(size_t tested, size_t consistent) const {
+            double log_lambda = consistent * m_log_consistent + (tested - consistent) * m_log_inconsistent;
+            return log_lambda > m_log_A;
+        }
+
+        void model_rejected(size_t tested, size_t consistent);
+
+        void best_model(real inlier_rate);
+
+    private:
+        void update_threshold();
+
+        double m_epsilon;
+        double m_delta;
+        double m_log_consistent;
+        double m_log_inconsistent;
+        double m_log_A;
+        size_t m_rejected_tested;
+        size_t m_rejected_consistent;
+    };
+
+    /*
+    Everything of a RANSAC run that does not depend on the model: settings,
+    results and the iteration limit.
+    */
+    class RANSACBase {
     public:
         size_t iter;
         real score;
+        InlierMask inliers; // of the final model, indexed like the dataset
+        bool confident;     // the iterations reached the success rate, not cut short by the limits
 
-        RANSAC(real success_rate = 0.99f, size_t max_iter = 10000000);
+        /*
+        Quality of every data point, higher is better, used by the next run() only.
+        With it samples come from the best points first, widening progressively (PROSAC).
+        */
+        void set_quality(const std::vector<real> &quality);
 
-        virtual ~RANSAC();
+        // Spread the hypotheses over the threads of pool, one slot per thread; nullptr runs serially.
+        void set_thread_pool(ThreadPool *pool);
 
-        void run();
+        // Results repeat for the same seed, data and thread count; 0 draws a new seed every run.
+        void set_seed(unsigned int seed);
 
-    protected:
-        virtual size_t data_size() const = 0;
-        virtual size_t sample_size() const = 0;
+        /*
+        Local optimization (LO-RANSAC, Lebeda et al. 2012): every new best model is improved
+        from inner_iterations non-minimal samples of its inliers, each refined by least squares
+        while the inlier threshold shrinks to the normal one. 0 turns it off.
+        */
+        void set_local_optimization(size_t inner_iterations);
 
-        virtual void reset_model() = 0;
-        virtual void fit_model(const std::vector<size_t> &sample_set) = 0;
-        virtual real eval_model(std::vector<bool> &inlier_set, size_t &inlier_count) = 0;
-        virtual void refine_model(const std::vector<bool> &inlier_set) = 0;
+        /*
+        Wall clock seconds a run() may take, 0 for no limit. When the budget runs out the best
+        model so far is returned with confident unset; results then depend on timing.
+        */
+        void set_time_budget(double seconds);
 
+    protected:
+        RANSACBase(real success_rate, size_t max_iter);
+        ~RANSACBase();
+
+        // Iterations that find an all inlier sample with success_rate, not limited by max_iter.
         size_t calc_iter_limit(real success_rate, real inlier_rate, size_t sample_size);
 
-    private:
+        // Seed of an independent random stream, a pure function of seed and stream.
+        static unsigned int derive_seed(unsigned int seed, unsigned int stream);
+
+        // Iterations each slot runs between two merges of the results.
+        static const size_t round_iterations = 4;
+
+        // Local optimization: inner samples hold at most lo_sample_factor times the minimal
+        // sample size, and each is refined in lo_steps with a threshold from lo_threshold_scale down to 1.
+        static const size_t lo_sample_factor = 7;
+        static const size_t lo_steps = 4;
+        static const int lo_threshold_scale = 3;
+
         real m_success_rate;
         size_t m_max_iter;
+        std::vector<real> m_quality;
+        ThreadPool *m_pool;
+        unsigned int m_seed;
+        size_t m_lo_iterations;
+        double m_time_budget;
+    };
+
+    /*
+    RANSAC over an Estimator deriving from RANSAC<Estimator, SampleSize> (CRTP), so that
+    fitting and evaluation inline into the loop. The estimator provides:
+
+        size_t data_size() const;
+        void reset_model();
+        void reset_slots(size_t count);                         // prepare count model slots
+        size_t fit_model(size_t slot, const sample_type &sample_set);
+        size_t fit_local(size_t slot, const std::vector<size_t> &sample_set);
+        real eval_block(size_t slot, size_t model, size_t begin, size_t end, real threshold_scale, std::uint64_t &mask);
+        void keep_model(size_t slot, size_t model);             // remember a model of the slot as its best
+        void use_model(size_t slot);                            // make the slot's best model the result
+        void refine_model(const InlierMask &inlier_set);
+
+    Model slots let run() fit and evaluate hypotheses on several threads at once:
+    every slot holds its own working models and its own best model, and an estimator
+    must only touch the given slot in fit_model, eval_block and keep_model.
+
+    fit_model returns how many models the sample gives, minimal solvers may find several
+    and degenerate samples none; they are numbered from 0 in eval_block and keep_model.
+    fit_local fits model 0 of the slot to more than sample_size points by least squares,
+    iterative methods starting from the slot's best model, and returns 1, or 0 on failure.
+    eval_block evaluates a model on data points [begin, end), at most one mask word:
+    bit i - begin of mask is set for an inlier i, and the score of the range is returned.
+    The inlier threshold is widened threshold_scale times, 1 except for local optimization.
+    run() visits the words in random order and stops evaluating a model part way once a
+    sequential probability ratio test (SPRT) shows it is worse than the best.
+    */
+    template <typename Estimator, size_t SampleSize>
+    class RANSAC : public RANSACBase {
+    public:
+        static const size_t sample_size = SampleSize;
+        typedef std::array<size_t, SampleSize> sample_type;
+
+        RANSAC(real success_rate = 0.99f, size_t max_iter = 10000000) : RANSACBase(success_rate, max_iter) {}
+
+        void run();
+
+    private:
+        Estimator &estimator() { return static_cast<Estimator &>(*this); }
     };
 
+    /*
+    Iterations are dealt round-robin to the slots and run in rounds of round_iterations per slot.
+    Between rounds the slot results are merged in slot order and the iteration limit and the SPRT
+    are updated, so the outcome depends only on the seed and the slot count, not on timing.
+    The time budget is checked between rounds as well.
+    */
+    template <typename Estimator, size_t SampleSize>
+    void RANSAC<Estimator, SampleSize>::run() {
+        const size_t ss = SampleSize;
+        Estimator &e = estimator();
+        size_t ds = e.data_size();
+        std::vector<real> quality;
+        quality.swap(m_quality);
+        iter = 0;
+        score = 0;
+        confident = false;
+        if (ds < ss) {
+            e.reset_model();
+            inliers.clear();
+            return;
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(m_time_budget);
+        const unsigned int run_seed = m_seed ? m_seed : get_random_seed();
+        const size_t slots = m_pool ? std::max(m_pool->size(), (size_t)1) : 1;
+        e.reset_slots(slots);
+
+        std::vector<size_t> order;
+        if (quality.size() == ds) {
+            order.resize(ds);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&quality](size_t a, size_t b) { return quality[a] > quality[b]; });
+        }
+
+        // mask words are visited in random order, neighbouring matches tend to agree with the same models
+        const size_t word_count = (ds + InlierMask::word_bits - 1) / InlierMask::word_bits;
+        std::vector<size_t> words(word_count);
+        std::iota(words.begin(), words.end(), 0);
+        std::shuffle(words.begin(), words.end(), std::default_random_engine(derive_seed(run_seed, 0)));
+
+        struct Worker {
+            LotBox cards;
+            std::unique_ptr<ProgressiveSampler> prosac;
+            sample_type sample_set;
+            InlierMask tmp_inlier_set;
+            InlierMask inlier_set;
+            real score;
+            size_t inlier_count;
+            bool improved;
+            SprtTest sprt;
+            size_t rejected_tested;
+            size_t rejected_consistent;
+            UniformInteger<size_t> lo_dice;
+            InlierMask lo_inlier_set;
+            std::vector<size_t> lo_indices;
+            std::vector<size_t> lo_sample_set;
+
+            Worker(size_t ds) : cards(ds) {
+                tmp_inlier_set.resize(ds);
+                inlier_set.resize(ds);
+                lo_inlier_set.resize(ds);
+            }
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (size_t k = 0; k < slots; ++k) {
+            workers.push_back(std::make_unique<Worker>(ds));
+            unsigned int worker_seed = derive_seed(run_seed, (unsigned int)k + 1);
+            workers[k]->lo_dice.seed(derive_seed(run_seed, (unsigned int)(slots + k + 1)));
+            if (order.empty()) {
+                workers[k]->cards.seed(worker_seed);
+            }
+            else {
+                workers[k]->prosac = std::make_unique<ProgressiveSampler>(order, ss, worker_seed);
+            }
+        }
+
+        // all words of model 0 without early rejection, for local optimization
+        auto evaluate = [&](size_t k, real threshold_scale, InlierMask &mask, size_t &inlier_count) {
+            real total = 0;
+            inlier_count = 0;
+            for (size_t b = 0; b < word_count; ++b) {
+                size_t begin = b * InlierMask::word_bits;
+                size_t end = std::min(begin + InlierMask::word_bits, ds);
+                total += e.eval_block(k, 0, begin, end, threshold_scale, mask.word(b));
+                inlier_count += popcount(mask.word(b));
+            }
+            return total;
+        };
+
+        // model 0 of slot k becomes the slot's best if it scores higher
+        auto try_local_model = [&](size_t k) {
+            Worker &w = *workers[k];
+            size_t tmp_inlier_count;
+            real tmp_score = evaluate(k, 1, w.tmp_inlier_set, tmp_inlier_count);
+            if (tmp_score > w.score) {
+                e.keep_model(k, 0);
+                w.inlier_set.swap(w.tmp_inlier_set);
+                w.score = tmp_score;
+                w.inlier_count = tmp_inlier_count;
+                w.improved = true;
+                w.sprt.best_model(tmp_inlier_count / (real)ds);
+            }
+        };
+
+        auto collect = [](const InlierMask &mask, std::vector<size_t> &indices) {
+            indices.clear();
+            for (size_t i = 0; i < mask.size(); ++i) {
+                if (mask[i]) {
+                    indices.push_back(i);
+                }
+            }
+        };
+
+        auto local_optimize = [&](size_t k) {
+            Worker &w = *workers[k];
+            for (size_t r = 0; r < m_lo_iterations; ++r) {
+                // a random subset of the best model's inliers, at most half of them
+                collect(w.inlier_set, w.lo_indices);
+                size_t n = std::min(lo_sample_factor * ss, w.lo_indices.size() / 2);
+                if (n <= ss) {
+                    return;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    std::swap(w.lo_indices[i], w.lo_indices[w.lo_dice.next(i, w.lo_indices.size() - 1)]);
+                }
+                w.lo_sample_set.assign(w.lo_indices.begin(), w.lo_indices.begin() + n);
+                if (e.fit_local(k, w.lo_sample_set) == 0) {
+                    continue;
+                }
+                try_local_model(k);
+
+                // iterative least squares on all inliers under a shrinking threshold
+                for (size_t step = 0; step < lo_steps; ++step) {
+                    real threshold_scale = lo_threshold_scale - (lo_threshold_scale - 1) * step / (real)(lo_steps - 1);
+                    size_t lo_inlier_count;
+                    evaluate(k, threshold_scale, w.lo_inlier_set, lo_inlier_count);
+                    if (lo_inlier_count <= ss) {
+                        break;
+                    }
+                    collect(w.lo_inlier_set, w.lo_sample_set);
+                    if (e.fit_local(k, w.lo_sample_set) == 0) {
+                        break;
+                    }
+                    try_local_model(k);
+                }
+            }
+        };
+
+        SprtTest sprt;
+        InlierMask inlier_set;
+        inlier_set.resize(ds);
+        size_t required_iter = std::numeric_limits<size_t>::max();
+        size_t iter_limit = m_max_iter;
+
+        while (iter < iter_limit) {
+            const size_t round_begin = iter;
+            const size_t round_end = std::min(iter_limit, round_begin + slots * round_iterations);
+
+            auto run_slot = [&](size_t k) {
+                Worker &w = *workers[k];
+                w.score = score;
+                w.improved = false;
+                w.sprt = sprt;
+                w.rejected_tested = w.rejected_consistent = 0;
+
+                for (size_t t = round_begin + k; t < round_end; t += slots) {
+                    if (w.prosac) {
+                        w.prosac->draw(t + 1, w.sample_set.data());
+                    }
+                    else {
+                        for (size_t i = 0; i < ss; ++i) {
+                            w.sample_set[i] = w.cards.draw_without_replacement();
+                        }
+                        w.cards.refill_all();
+                    }
+
+                    size_t model_count = e.fit_model(k, w.sample_set);
+                    bool found = false;
+                    for (size_t model = 0; model < model_count; ++model) {
+                        real tmp_score = 0;
+                        size_t tested = 0, tmp_inlier_count = 0;
+                        bool rejected = false;
+                        for (size_t b = 0; b < word_count; ++b) {
+                            size_t begin = words[b] * InlierMask::word_bits;
+                            size_t end = std::min(begin + InlierMask::word_bits, ds);
+                            std::uint64_t &mask = w.tmp_inlier_set.word(words[b]);
+                            tmp_score += e.eval_block(k, model, begin, end, 1, mask);
+                            tmp_inlier_count += popcount(mask);
+                            tested += end - begin;
+                            if (w.sprt.reject(tested, tmp_inlier_count)) {
+                                rejected = true;
+                                break;
+                            }
+                        }
+
+                        if (rejected) {
+                            w.sprt.model_rejected(tested, tmp_inlier_count);
+                            w.rejected_tested += tested;
+                            w.rejected_consistent += tmp_inlier_count;
+                        }
+                        else if (tmp_score > w.score) {
+                            e.keep_model(k, model);
+                            w.inlier_set.swap(w.tmp_inlier_set);
+                            w.score = tmp_score;
+                            w.inlier_count = tmp_inlier_count;
+                            w.improved = true;
+                            found = true;
+                            w.sprt.best_model(tmp_inlier_count / (real)ds);
+                        }
+                    }
+
+                    // after the loop, fit_local reuses the working models of the sample
+                    if (found && m_lo_iterations > 0) {
+                        local_optimize(k);
+                    }
+                }
+            };
+
+            if (m_pool && slots > 1) {
+                m_pool->parallel_for(slots, run_slot);
+            }
+            else {
+                for (size_t k = 0; k < slots; ++k) {
+                    run_slot(k);
+                }
+            }
+
+            bool improved = false;
+            size_t inlier_count = 0;
+            for (size_t k = 0; k < slots; ++k) {
+                Worker &w = *workers[k];
+                if (w.rejected_tested > 0) {
+                    sprt.model_rejected(w.rejected_tested, w.rejected_consistent);
+                }
+                if (w.improved && w.score > score) {
+                    // the slot may overwrite its model next round, take it now
+                    e.use_model(k);
+                    inlier_set = w.inlier_set;
+                    score = w.score;
+                    inlier_count = w.inlier_count;
+                    improved = true;
+                }
+            }
+
+            iter = round_end;
+            if (improved) {
+                real inlier_rate = inlier_count / (real)ds;
+                sprt.best_model(inlier_rate);
+                // a good sample only counts if its model also passes the test, with probability 1 - 1/A
+                real pass_rate = (real)(1.0 - 1.0 / sprt.threshold());
+                required_iter = calc_iter_limit(m_success_rate, inlier_rate * std::pow(pass_rate, 1.0f / ss), ss);
+                iter_limit = std::min(required_iter, m_max_iter);
+            }
+
+            if (m_time_budget > 0 && iter < iter_limit && std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+        }
+        confident = iter >= required_iter;
+
+        e.refine_model(inlier_set);
+        inliers.swap(inlier_set);
+    }
+
 }
@@ -63,11 +63,13 @@ class UniformInteger : protected _RandomBase {
 public:
     typedef T value_type;
 
+    using _RandomBase::seed;
+
     // [left, right]
     UniformInteger(value_type left = value_type(0), value_type right = std::numeric_limits<T>::max()) : distribution(left, right) {}
 
     void param(value_type left, value_type right) {
-        distribution.param(std::uniform_int_distribution<value_type>::param_type(left, right));
+        distribution.param(typename std::uniform_int_distribution<value_type>::param_type(left, right));
     }
 
     value_type next() {
@@ -75,7 +77,7 @@ public:
     }
 
     value_type next(value_type left, value_type right) {
-        return distribution(engine, std::uniform_int_distribution<value_type>::param_type(left, right));
+        return distribution(engine, typename std::uniform_int_distribution<value_type>::param_type(left, right));
     }
 private:
     std::uniform_int_distribution<value_type> distribution;
@@ -87,6 +89,10 @@ public:
         std::iota(lots.begin(), lots.end(), 0);
     }
 
+    void seed(unsigned int value) {
+        dice.seed(value);
+    }
+
     size_t draw_with_replacement() {
         size_t result = draw_without_replacement();
         refill_last();
@@ -0,0 +1,265 @@
+#include "CpuFeatures.h"
+#include "ScoreKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SLAM_SCORE_X86
+#include <immintrin.h>
+#endif
+
+using namespace slam;
+
+namespace {
+
+    const float chi_square_essential = 3.841f;   // 95%, one degree of freedom
+    const float chi_square_homography = 5.991f;  // 95%, two degrees of freedom
+
+    typedef real(*essential_fn)(const mat3 &, const PairArray &, size_t, size_t, const ScoreParams &, std::uint64_t &);
+    typedef real(*homography_fn)(const mat3 &, const mat3 &, const PairArray &, size_t, size_t, const ScoreParams &, std::uint64_t &);
+    typedef real(*projection_fn)(const mat3 &, const vec3 &, const ProjectionArray &, size_t, size_t, const ScoreParams &, std::uint64_t &);
+
+    struct ScoreKernel {
+        const char *name;
+        essential_fn essential;
+        homography_fn homography;
+        projection_fn projection;
+    };
+
+    // Scalar generation, also scores the tails the vector kernels leave.
+
+    inline void essential_point(const mat3 &E, float ax, float ay, float bx, float by, float ifx, float ify, float inv_sigma_square, float &chi_square_1, float &chi_square_2) {
+        float l2x = E(0, 0)*ax + E(0, 1)*ay + E(0, 2);
+        float l2y = E(1, 0)*ax + E(1, 1)*ay + E(1, 2);
+        float l2z = E(2, 0)*ax + E(2, 1)*ay + E(2, 2);
+        float l1x = E(0, 0)*bx + E(1, 0)*by + E(2, 0);
+        float l1y = E(0, 1)*bx + E(1, 1)*by + E(2, 1);
+        float d = l2x*bx + l2y*by + l2z;
+        float A1 = l1x*ifx, B1 = l1y*ify;
+        float A2 = l2x*ifx, B2 = l2y*ify;
+        float dd = d*d*inv_sigma_square;
+        chi_square_1 = dd / (A1*A1 + B1*B1);
+        chi_square_2 = dd / (A2*A2 + B2*B2);
+    }
+
+    inline void homography_point(const mat3 &H, const mat3 &Hinv, float ax, float ay, float bx, float by, float fx, float fy, float inv_sigma_square, float &chi_square_1, float &chi_square_2) {
+        float hax = H(0, 0)*ax + H(0, 1)*ay + H(0, 2);
+        float hay = H(1, 0)*ax + H(1, 1)*ay + H(1, 2);
+        float haz = H(2, 0)*ax + H(2, 1)*ay + H(2, 2);
+        float hbx = Hinv(0, 0)*bx + Hinv(0, 1)*by + Hinv(0, 2);
+        float hby = Hinv(1, 0)*bx + Hinv(1, 1)*by + Hinv(1, 2);
+        float hbz = Hinv(2, 0)*bx + Hinv(2, 1)*by + Hinv(2, 2);
+        float ex1 = (hax / haz - bx)*fx, ey1 = (hay / haz - by)*fy;
+        float ex2 = (hbx / hbz - ax)*fx, ey2 = (hby / hbz - ay)*fy;
+        chi_square_1 = (ex1*ex1 + ey1*ey1)*inv_sigma_square;
+        chi_square_2 = (ex2*ex2 + ey2*ey2)*inv_sigma_square;
+    }
+
+    inline float projection_point(const mat3 &R, const vec3 &T, float px, float py, float pz, float bx, float by, float fx, float fy, float inv_sigma_square) {
+        float x = R(0, 0)*px + R(0, 1)*py + R(0, 2)*pz + T(0);
+        float y = R(1, 0)*px + R(1, 1)*py + R(1, 2)*pz + T(1);
+        float z = R(2, 0)*px + R(2, 1)*py + R(2, 2)*pz + T(2);
+        float ex = (x / z - bx)*fx, ey = (y / z - by)*fy;
+        return (ex*ex + ey*ey)*inv_sigma_square;
+    }
+
+    real essential_tail(const mat3 &E, const PairArray &pairs, size_t i, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        const float ifx = 1.0f / params.fx, ify = 1.0f / params.fy;
+        real score = 0;
+        for (; i < end; ++i) {
+            float chi_square_1, chi_square_2;
+            essential_point(E, pairs.ax[i], pairs.ay[i], pairs.bx[i], pairs.by[i], ifx, ify, params.inv_sigma_square, chi_square_1, chi_square_2);
+            if (chi_square_1 < chi_square_essential && chi_square_2 < chi_square_essential) {
+                mask |= std::uint64_t(1) << (i - begin);
+                score += 2.0f*chi_square_homography - chi_square_1 - chi_square_2;
+            }
+        }
+        return score;
+    }
+
+    real homography_tail(const mat3 &H, const mat3 &Hinv, const PairArray &pairs, size_t i, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        real score = 0;
+        for (; i < end; ++i) {
+            float chi_square_1, chi_square_2;
+            homography_point(H, Hinv, pairs.ax[i], pairs.ay[i], pairs.bx[i], pairs.by[i], params.fx, params.fy, params.inv_sigma_square, chi_square_1, chi_square_2);
+            if (chi_square_1 < chi_square_homography && chi_square_2 < chi_square_homography) {
+                mask |= std::uint64_t(1) << (i - begin);
+                score += 2.0f*chi_square_homography - chi_square_1 - chi_square_2;
+            }
+        }
+        return score;
+    }
+
+    real projection_tail(const mat3 &R, const vec3 &T, const ProjectionArray &points, size_t i, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        real score = 0;
+        for (; i < end; ++i) {
+            float chi_square = projection_point(R, T, points.px[i], points.py[i], points.pz[i], points.bx[i], points.by[i], params.fx, params.fy, params.inv_sigma_square);
+            if (chi_square < chi_square_homography) {
+                mask |= std::uint64_t(1) << (i - begin);
+                score += chi_square_homography - chi_square;
+            }
+        }
+        return score;
+    }
+
+    real essential_scalar(const mat3 &E, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        mask = 0;
+        return essential_tail(E, pairs, begin, begin, end, params, mask);
+    }
+
+    real homography_scalar(const mat3 &H, const mat3 &Hinv, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        mask = 0;
+        return homography_tail(H, Hinv, pairs, begin, begin, end, params, mask);
+    }
+
+    real projection_scalar(const mat3 &R, const vec3 &T, const ProjectionArray &points, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        mask = 0;
+        return projection_tail(R, T, points, begin, begin, end, params, mask);
+    }
+
+#ifdef SLAM_SCORE_X86
+
+    // AVX2 generation: eight points per register, same arithmetic as the scalar kernels lane by lane.
+
+    SLAM_TARGET_AVX2 inline __m256 mad(__m256 a, __m256 b, __m256 c) {
+        return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+    }
+
+    SLAM_TARGET_AVX2 inline float horizontal_sum(__m256 v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    SLAM_TARGET_AVX2 real essential_avx2(const mat3 &E, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        const __m256 e00 = _mm256_set1_ps(E(0, 0)), e01 = _mm256_set1_ps(E(0, 1)), e02 = _mm256_set1_ps(E(0, 2));
+        const __m256 e10 = _mm256_set1_ps(E(1, 0)), e11 = _mm256_set1_ps(E(1, 1)), e12 = _mm256_set1_ps(E(1, 2));
+        const __m256 e20 = _mm256_set1_ps(E(2, 0)), e21 = _mm256_set1_ps(E(2, 1)), e22 = _mm256_set1_ps(E(2, 2));
+        const __m256 ifx = _mm256_set1_ps(1.0f / params.fx), ify = _mm256_set1_ps(1.0f / params.fy);
+        const __m256 inv_sigma_square = _mm256_set1_ps(params.inv_sigma_square);
+        const __m256 threshold = _mm256_set1_ps(chi_square_essential);
+        const __m256 base = _mm256_set1_ps(2.0f*chi_square_homography);
+
+        __m256 score = _mm256_setzero_ps();
+        mask = 0;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 ax = _mm256_loadu_ps(&pairs.ax[i]), ay = _mm256_loadu_ps(&pairs.ay[i]);
+            __m256 bx = _mm256_loadu_ps(&pairs.bx[i]), by = _mm256_loadu_ps(&pairs.by[i]);
+            __m256 l2x = _mm256_add_ps(mad(e01, ay, _mm256_mul_ps(e00, ax)), e02);
+            __m256 l2y = _mm256_add_ps(mad(e11, ay, _mm256_mul_ps(e10, ax)), e12);
+            __m256 l2z = _mm256_add_ps(mad(e21, ay, _mm256_mul_ps(e20, ax)), e22);
+            __m256 l1x = _mm256_add_ps(mad(e10, by, _mm256_mul_ps(e00, bx)), e20);
+            __m256 l1y = _mm256_add_ps(mad(e11, by, _mm256_mul_ps(e01, bx)), e21);
+            __m256 d = _mm256_add_ps(mad(l2y, by, _mm256_mul_ps(l2x, bx)), l2z);
+            __m256 A1 = _mm256_mul_ps(l1x, ifx), B1 = _mm256_mul_ps(l1y, ify);
+            __m256 A2 = _mm256_mul_ps(l2x, ifx), B2 = _mm256_mul_ps(l2y, ify);
+            __m256 dd = _mm256_mul_ps(_mm256_mul_ps(d, d), inv_sigma_square);
+            __m256 chi_square_1 = _mm256_div_ps(dd, mad(B1, B1, _mm256_mul_ps(A1, A1)));
+            __m256 chi_square_2 = _mm256_div_ps(dd, mad(B2, B2, _mm256_mul_ps(A2, A2)));
+            __m256 inlier = _mm256_and_ps(_mm256_cmp_ps(chi_square_1, threshold, _CMP_LT_OQ), _mm256_cmp_ps(chi_square_2, threshold, _CMP_LT_OQ));
+            __m256 point_score = _mm256_sub_ps(_mm256_sub_ps(base, chi_square_1), chi_square_2);
+            score = _mm256_add_ps(score, _mm256_and_ps(inlier, point_score));
+            mask |= (std::uint64_t)_mm256_movemask_ps(inlier) << (i - begin);
+        }
+        return horizontal_sum(score) + essential_tail(E, pairs, i, begin, end, params, mask);
+    }
+
+    SLAM_TARGET_AVX2 real homography_avx2(const mat3 &H, const mat3 &Hinv, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        const __m256 h00 = _mm256_set1_ps(H(0, 0)), h01 = _mm256_set1_ps(H(0, 1)), h02 = _mm256_set1_ps(H(0, 2));
+        const __m256 h10 = _mm256_set1_ps(H(1, 0)), h11 = _mm256_set1_ps(H(1, 1)), h12 = _mm256_set1_ps(H(1, 2));
+        const __m256 h20 = _mm256_set1_ps(H(2, 0)), h21 = _mm256_set1_ps(H(2, 1)), h22 = _mm256_set1_ps(H(2, 2));
+        const __m256 g00 = _mm256_set1_ps(Hinv(0, 0)), g01 = _mm256_set1_ps(Hinv(0, 1)), g02 = _mm256_set1_ps(Hinv(0, 2));
+        const __m256 g10 = _mm256_set1_ps(Hinv(1, 0)), g11 = _mm256_set1_ps(Hinv(1, 1)), g12 = _mm256_set1_ps(Hinv(1, 2));
+        const __m256 g20 = _mm256_set1_ps(Hinv(2, 0)), g21 = _mm256_set1_ps(Hinv(2, 1)), g22 = _mm256_set1_ps(Hinv(2, 2));
+        const __m256 fx = _mm256_set1_ps(params.fx), fy = _mm256_set1_ps(params.fy);
+        const __m256 inv_sigma_square = _mm256_set1_ps(params.inv_sigma_square);
+        const __m256 threshold = _mm256_set1_ps(chi_square_homography);
+        const __m256 base = _mm256_set1_ps(2.0f*chi_square_homography);
+
+        __m256 score = _mm256_setzero_ps();
+        mask = 0;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 ax = _mm256_loadu_ps(&pairs.ax[i]), ay = _mm256_loadu_ps(&pairs.ay[i]);
+            __m256 bx = _mm256_loadu_ps(&pairs.bx[i]), by = _mm256_loadu_ps(&pairs.by[i]);
+            __m256 hax = _mm256_add_ps(mad(h01, ay, _mm256_mul_ps(h00, ax)), h02);
+            __m256 hay = _mm256_add_ps(mad(h11, ay, _mm256_mul_ps(h10, ax)), h12);
+            __m256 haz = _mm256_add_ps(mad(h21, ay, _mm256_mul_ps(h20, ax)), h22);
+            __m256 hbx = _mm256_add_ps(mad(g01, by, _mm256_mul_ps(g00, bx)), g02);
+            __m256 hby = _mm256_add_ps(mad(g11, by, _mm256_mul_ps(g10, bx)), g12);
+            __m256 hbz = _mm256_add_ps(mad(g21, by, _mm256_mul_ps(g20, bx)), g22);
+            __m256 ex1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(hax, haz), bx), fx);
+            __m256 ey1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(hay, haz), by), fy);
+            __m256 ex2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(hbx, hbz), ax), fx);
+            __m256 ey2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(hby, hbz), ay), fy);
+            __m256 chi_square_1 = _mm256_mul_ps(mad(ey1, ey1, _mm256_mul_ps(ex1, ex1)), inv_sigma_square);
+            __m256 chi_square_2 = _mm256_mul_ps(mad(ey2, ey2, _mm256_mul_ps(ex2, ex2)), inv_sigma_square);
+            __m256 inlier = _mm256_and_ps(_mm256_cmp_ps(chi_square_1, threshold, _CMP_LT_OQ), _mm256_cmp_ps(chi_square_2, threshold, _CMP_LT_OQ));
+            __m256 point_score = _mm256_sub_ps(_mm256_sub_ps(base, chi_square_1), chi_square_2);
+            score = _mm256_add_ps(score, _mm256_and_ps(inlier, point_score));
+            mask |= (std::uint64_t)_mm256_movemask_ps(inlier) << (i - begin);
+        }
+        return horizontal_sum(score) + homography_tail(H, Hinv, pairs, i, begin, end, params, mask);
+    }
+
+    SLAM_TARGET_AVX2 real projection_avx2(const mat3 &R, const vec3 &T, const ProjectionArray &points, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+        const __m256 r00 = _mm256_set1_ps(R(0, 0)), r01 = _mm256_set1_ps(R(0, 1)), r02 = _mm256_set1_ps(R(0, 2));
+        const __m256 r10 = _mm256_set1_ps(R(1, 0)), r11 = _mm256_set1_ps(R(1, 1)), r12 = _mm256_set1_ps(R(1, 2));
+        const __m256 r20 = _mm256_set1_ps(R(2, 0)), r21 = _mm256_set1_ps(R(2, 1)), r22 = _mm256_set1_ps(R(2, 2));
+        const __m256 t0 = _mm256_set1_ps(T(0)), t1 = _mm256_set1_ps(T(1)), t2 = _mm256_set1_ps(T(2));
+        const __m256 fx = _mm256_set1_ps(params.fx), fy = _mm256_set1_ps(params.fy);
+        const __m256 inv_sigma_square = _mm256_set1_ps(params.inv_sigma_square);
+        const __m256 threshold = _mm256_set1_ps(chi_square_homography);
+
+        __m256 score = _mm256_setzero_ps();
+        mask = 0;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 px = _mm256_loadu_ps(&points.px[i]), py = _mm256_loadu_ps(&points.py[i]), pz = _mm256_loadu_ps(&points.pz[i]);
+            __m256 bx = _mm256_loadu_ps(&points.bx[i]), by = _mm256_loadu_ps(&points.by[i]);
+            __m256 x = _mm256_add_ps(mad(r02, pz, mad(r01, py, _mm256_mul_ps(r00, px))), t0);
+            __m256 y = _mm256_add_ps(mad(r12, pz, mad(r11, py, _mm256_mul_ps(r10, px))), t1);
+            __m256 z = _mm256_add_ps(mad(r22, pz, mad(r21, py, _mm256_mul_ps(r20, px))), t2);
+            __m256 ex = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(x, z), bx), fx);
+            __m256 ey = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(y, z), by), fy);
+            __m256 chi_square = _mm256_mul_ps(mad(ey, ey, _mm256_mul_ps(ex, ex)), inv_sigma_square);
+            __m256 inlier = _mm256_cmp_ps(chi_square, threshold, _CMP_LT_OQ);
+            score = _mm256_add_ps(score, _mm256_and_ps(inlier, _mm256_sub_ps(threshold, chi_square)));
+            mask |= (std::uint64_t)_mm256_movemask_ps(inlier) << (i - begin);
+        }
+        return horizontal_sum(score) + projection_tail(R, T, points, i, begin, end, params, mask);
+    }
+
+#endif
+
+    ScoreKernel select_kernel() {
+#ifdef SLAM_SCORE_X86
+        if (cpu_features().avx2) {
+            return ScoreKernel{ "avx2", essential_avx2, homography_avx2, projection_avx2 };
+        }
+#endif
+        return ScoreKernel{ "scalar", essential_scalar, homography_scalar, projection_scalar };
+    }
+
+    const ScoreKernel &kernel() {
+        static const ScoreKernel k = select_kernel();
+        return k;
+    }
+
+}
+
+real slam::score_essential(const mat3 &E, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+    return kernel().essential(E, pairs, begin, end, params, mask);
+}
+
+real slam::score_homography(const mat3 &H, const mat3 &Hinv, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+    return kernel().homography(H, Hinv, pairs, begin, end, params, mask);
+}
+
+real slam::score_projection(const mat3 &R, const vec3 &T, const ProjectionArray &points, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask) {
+    return kernel().projection(R, T, points, begin, end, params, mask);
+}
+
+const char *slam::score_kernel_name() {
+    return kernel().name;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include "AlignedAllocator.h"
+#include "Types.h"
+
+namespace slam {
+
+    /*
+    Scoring of a RANSAC model on n <= 64 points stored as separate coordinate arrays
+    (structure of arrays), filling bit i of mask for an inlier i and returning the
+    summed score of the inliers. Points are normalized image coordinates; fx, fy
+    turn their errors into pixels, compared against chi-square thresholds in sigma units.
+    */
+
+    // Point pairs of a two view model, gathered once per dataset.
+    struct PairArray {
+        aligned_vector<float> ax, ay, bx, by;
+
+        void resize(size_t n) {
+            ax.resize(n);
+            ay.resize(n);
+            bx.resize(n);
+            by.resize(n);
+        }
+
+        size_t size() const { return ax.size(); }
+    };
+
+    // World points and their observations for a pose model.
+    struct ProjectionArray {
+        aligned_vector<float> px, py, pz, bx, by;
+
+        void resize(size_t n) {
+            px.resize(n);
+            py.resize(n);
+            pz.resize(n);
+            bx.resize(n);
+            by.resize(n);
+        }
+
+        size_t size() const { return px.size(); }
+    };
+
+    struct ScoreParams {
+        float fx, fy;
+        float inv_sigma_square;
+
+        // The same with sigma, and so the inlier threshold, scale times larger.
+        ScoreParams widened(float scale) const {
+            return ScoreParams{ fx, fy, inv_sigma_square / (scale*scale) };
+        }
+    };
+
+    // Distances of a to the epipolar line of b and of b to that of a under the essential matrix E, b^T E a = 0.
+    real score_essential(const mat3 &E, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask);
+
+    // Transfer errors of b = H a and a = Hinv b.
+    real score_homography(const mat3 &H, const mat3 &Hinv, const PairArray &pairs, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask);
+
+    // Reprojection errors of the world points under the pose x = R p + T.
+    real score_projection(const mat3 &R, const vec3 &T, const ProjectionArray &points, size_t begin, size_t end, const ScoreParams &params, std::uint64_t &mask);
+
+    // Name of the kernels picked for this CPU: "avx2" or "scalar".
+    const char *score_kernel_name();
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace slam {
+
+    /*
+    Bounded queue between exactly one producer and one consumer thread, without locks.
+    Neither side ever waits on the other: push fails when the queue is full, pop when it is empty.
+    */
+    template <typename T>
+    class SpscQueue {
+    public:
+        explicit SpscQueue(size_t capacity) : m_slots(capacity + 1), m_head(0), m_tail(0) {}
+
+        // Producer side.
+        bool push(T &&value) {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t next = advance(tail);
+            if (next == m_head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            m_slots[tail] = std::move(value);
+            m_tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side, the slot is left moved from.
+        bool pop(T &value) {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            value = std::move(m_slots[head]);
+            m_head.store(advance(head), std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        size_t advance(size_t i) const {
+            return (i + 1 == m_slots.size()) ? 0 : i + 1;
+        }
+
+        std::vector<T> m_slots; // one more than the capacity, so full and empty differ
+        std::atomic<size_t> m_head; // next slot to pop, written by the consumer
+        std::atomic<size_t> m_tail; // next slot to push, written by the producer
+    };
+
+}
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include "System.h"
 #include "OcvYamlConfig.h"
 #include "OcvImageSequenceStream.h"
 #include "OcvCameraImageStream.h"
 #include "Tracker.h"
+#include "Feature.h"
+#include "Vocabulary.h"
 
 using namespace slam;
 
@@ -32,3 +35,27 @@ int System::run() {
     }
     return 0;
 }
+
+int System::train_vocabulary(const std::string &filepath) {
+    std::unique_ptr<FeatureExtractor> extractor = FeatureExtractor::create(m_config.get());
+    int step = std::max((int)m_config->value("Vocabulary.trainStep", 10), 1);
+
+    std::vector<DescriptorArray> images;
+    for (int n = 0; auto image = m_stream->next(); ++n) {
+        if (n % step != 0) {
+            continue;
+        }
+        auto feature = extractor->extract(image.get());
+        if (feature && feature->descriptors()) {
+            images.push_back(*feature->descriptors());
+        }
+    }
+
+    Vocabulary vocabulary;
+    vocabulary.train(images,
+        (int)m_config->value("Vocabulary.branching", 10),
+        (int)m_config->value("Vocabulary.depth", 6)
+    );
+
+    return vocabulary.save(filepath) ? 0 : 1;
+}
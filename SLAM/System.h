@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 namespace slam {
 
@@ -15,6 +16,9 @@ namespace slam {
 
         int run();
 
+        // Build a vocabulary from the configured input stream and save it to filepath.
+        int train_vocabulary(const std::string &filepath);
+
     private:
         std::unique_ptr<Config> m_config;
         std::unique_ptr<ImageStream> m_stream;
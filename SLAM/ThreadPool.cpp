@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <atomic>
+#include "ThreadPool.h"
+
+using namespace slam;
+
+namespace {
+
+    struct ParallelForState {
+        std::function<void(size_t)> body;
+        size_t n;
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        // Claim and run indices until none are left.
+        void run() {
+            size_t i;
+            while ((i = next++) < n) {
+                body(i);
+                if (++done == n) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            }
+        }
+    };
+
+}
+
+ThreadPool::ThreadPool(size_t threads) : m_stop(false) {
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return m_threads.size();
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)> &body) {
+    if (n == 0) {
+        return;
+    }
+    if (n == 1 || m_threads.empty()) {
+        for (size_t i = 0; i < n; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    // helpers that start late find nothing left and just drop their reference
+    auto state = std::make_shared<ParallelForState>();
+    state->body = body;
+    state->n = n;
+    state->next = 0;
+    state->done = 0;
+
+    size_t helpers = std::min(n - 1, m_threads.size());
+    for (size_t k = 0; k < helpers; ++k) {
+        enqueue([state]() { state->run(); });
+    }
+
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->done == state->n; });
+}
+
+void ThreadPool::enqueue(std::function<void()> &&task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::worker() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace slam {
+
+    /*
+    Fixed set of worker threads fed from one task queue.
+    parallel_for lets the calling thread take part and never waits on queued
+    tasks, so it is safe to call from inside a task.
+    */
+    class ThreadPool {
+    public:
+        // threads == 0 uses one thread per hardware core.
+        explicit ThreadPool(size_t threads = 0);
+        ~ThreadPool();
+
+        size_t size() const;
+
+        template <typename F>
+        auto submit(F &&f) -> std::future<decltype(f())> {
+            typedef decltype(f()) result_type;
+            auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(f));
+            std::future<result_type> result = task->get_future();
+            enqueue([task]() { (*task)(); });
+            return result;
+        }
+
+        // Run body(i) for every i in [0, n) and wait for all of them.
+        void parallel_for(size_t n, const std::function<void(size_t)> &body);
+
+    private:
+        void enqueue(std::function<void()> &&task);
+        void worker();
+
+        std::vector<std::thread> m_threads;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        bool m_stop;
+    };
+
+}
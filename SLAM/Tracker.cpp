@@ -1,14 +1,19 @@
+#include <algorithm>
 #include "Tracker.h"
 #include "Config.h"
 #include "Image.h"
-#include "OcvOrbFeature.h"
+#include "Feature.h"
 #include "LazyPairInitializer.h"
 #include "CeresMap.h"
+#include "OcvLKTracker.h"
 
 #include "OcvHelperFunctions.h"
 
 using namespace slam;
 
+// Least time a pose estimate gets once the frame time is used up, in seconds.
+static const double min_time_budget = 0.001;
+
 Frame::Frame(std::unique_ptr<Feature>&& feature) {
     this->feature = std::move(feature);
 }
@@ -16,17 +21,34 @@ Frame::Frame(std::unique_ptr<Feature>&& feature) {
 Frame::~Frame() = default;
 
 Tracker::Tracker(const Config *config) {
-    m_extractor = std::make_unique<OcvOrbFeatureExtractor>(config);
+    m_extractor = FeatureExtractor::create(config);
     m_initializer = std::make_unique<LazyPairInitializer>(config);
     m_map = std::make_unique<CeresMap>(config);
     m_status = STATE_INITIALIZING;
+
+    // without a vocabulary there is nothing to relocalize against, rebuild right away
+    m_lost_frames = 0;
+    m_max_lost_frames = config->text("Vocabulary.file", "", false).empty() ? 0 : (int)config->value("Tracker.maxLostFrames", 30);
+
+    if (config->value("Tracker.opticalFlow", 0) != 0) {
+        m_point_tracker = std::make_unique<OcvLKTracker>(config);
+    }
+    m_min_tracks = (size_t)config->value("Tracker.minTracks", 50);
+    m_frame_time = config->value("Tracker.frameTime", 0.0);
 }
 
 Tracker::~Tracker() = default;
 
 void Tracker::track(const Image *image) {
-    std::shared_ptr<Frame> pframe = std::make_shared<Frame>(m_extractor->extract(image));
     OcvHelperFunctions::current_image = image;
+    m_frame_start = std::chrono::steady_clock::now();
+
+    // most frames are no keyframes, their pose comes from the tracked landmarks
+    if (m_status == STATE_TRACKING && m_point_tracker && track_points(image)) {
+        return;
+    }
+
+    std::shared_ptr<Frame> pframe = std::make_shared<Frame>(m_extractor->extract(image));
     OcvHelperFunctions::show_keypoints(pframe->feature.get(), 1);
     if (m_status == STATE_INITIALIZING) {
         if (m_initializer->initialize(pframe)) {
@@ -37,12 +59,87 @@ void Tracker::track(const Image *image) {
         }
     }
     else if (m_status == STATE_TRACKING) {
+        update_time_budget();
         if (!m_map->localize(pframe)) {
             m_status = STATE_LOST;
+            m_lost_frames = 0;
         }
     }
     else if (m_status == STATE_LOST) {
-        m_map->clear();
-        m_status = STATE_INITIALIZING;
+        update_time_budget();
+        if (m_map->relocalize(pframe)) {
+            m_status = STATE_TRACKING;
+        }
+        else if (++m_lost_frames > m_max_lost_frames) {
+            m_map->clear();
+            m_status = STATE_INITIALIZING;
+        }
+    }
+
+    if (m_status == STATE_TRACKING && m_point_tracker) {
+        reset_points(image, *pframe);
+    }
+}
+
+bool Tracker::track_points(const Image *image) {
+    if (m_track_landmarks.size() < m_min_tracks) {
+        return false;
+    }
+
+    KeypointArray points;
+    std::vector<bool> status;
+    m_point_tracker->track(image, m_track_points, points, status);
+
+    match_vector tracks;
+    tracks.reserve(status.size());
+    for (size_t i = 0; i < status.size(); ++i) {
+        if (status[i]) {
+            tracks.emplace_back(m_track_landmarks[i], (index_t)i);
+        }
+    }
+    if (tracks.size() < m_min_tracks) {
+        return false;
+    }
+
+    mat3 R;
+    vec3 T;
+    update_time_budget();
+    if (!m_map->localize_tracks(points, tracks, R, T) || tracks.size() < m_min_tracks) {
+        return false;
+    }
+
+    // only the inliers are followed into the next frame
+    m_track_points.resize(tracks.size());
+    m_track_landmarks.resize(tracks.size());
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        m_track_points.set(i, points[tracks[i].second]);
+        m_track_landmarks[i] = tracks[i].first;
+    }
+    return true;
+}
+
+void Tracker::reset_points(const Image *image, const Frame &frame) {
+    m_track_points.resize(0);
+    m_track_landmarks.clear();
+    for (size_t i = 0; i < frame.landmark_map.size(); ++i) {
+        if (frame.landmark_map[i] != invalid_index) {
+            m_track_landmarks.push_back(frame.landmark_map[i]);
+        }
+    }
+
+    m_track_points.resize(m_track_landmarks.size());
+    for (size_t i = 0, k = 0; i < frame.landmark_map.size(); ++i) {
+        if (frame.landmark_map[i] != invalid_index) {
+            m_track_points.set(k++, frame.feature->keypoints[i]);
+        }
+    }
+    m_point_tracker->set_reference(image);
+}
+
+void Tracker::update_time_budget() {
+    if (m_frame_time <= 0) {
+        return;
     }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_frame_start).count();
+    m_map->set_time_budget(std::max(m_frame_time - elapsed, min_time_budget));
 }
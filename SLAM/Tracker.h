@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include "Types.h"
 
@@ -11,6 +12,7 @@ namespace slam {
     class FeatureExtractor;
     class Initializer;
     class Map;
+    class PointTracker;
 
     class Frame {
     public:
@@ -22,8 +24,8 @@ namespace slam {
         mat3 R;
         vec3 T;
 
-        size_t keyframe_id;
-        std::vector<size_t> landmark_map;
+        index_t keyframe_id;
+        std::vector<index_t> landmark_map; // landmark id of each keypoint, invalid_index if unmapped
     };
 
     class Tracker {
@@ -35,11 +37,32 @@ namespace slam {
         void track(const Image *image);
 
     private:
+        // Follow the tracked landmarks into image and localize from them alone.
+        bool track_points(const Image *image);
+
+        // Start tracking the mapped keypoints of a localized frame.
+        void reset_points(const Image *image, const Frame &frame);
+
+        // Hand what is left of the frame time to the pose estimates of the map.
+        void update_time_budget();
+
         enum TrackState { STATE_INITIALIZING, STATE_TRACKING, STATE_LOST } m_status;
 
+        int m_lost_frames;
+        int m_max_lost_frames;
+
         std::unique_ptr<FeatureExtractor> m_extractor;
         std::unique_ptr<Initializer> m_initializer;
         std::unique_ptr<Map> m_map;
+
+        // optical flow tracking between full extractions, nullptr when disabled
+        std::unique_ptr<PointTracker> m_point_tracker;
+        KeypointArray m_track_points;
+        std::vector<index_t> m_track_landmarks;
+        size_t m_min_tracks;
+
+        double m_frame_time; // seconds per frame, 0 for no limit
+        std::chrono::steady_clock::time_point m_frame_start;
     };
 
 }
@@ -0,0 +1,175 @@
+#include <cmath>
+#include "CpuFeatures.h"
+#include "TriangulationKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SLAM_TRIANGULATION_X86
+#include <immintrin.h>
+#endif
+
+using namespace slam;
+
+namespace {
+
+    // Rays closer to parallel than this, in squared sine of their angle, give no point.
+    const float min_ray_sine_square = 1.0e-10f;
+
+    typedef void(*triangulate_fn)(const mat3 &, const vec3 &, const PairArray &, size_t, size_t, float, float, float, PointArray &, float *, std::uint64_t &);
+
+    struct TriangulationKernel {
+        const char *name;
+        triangulate_fn triangulate;
+    };
+
+    /*
+    Scalar generation, also triangulates the tails the vector kernel leaves.
+    Rt = R^T and c = R^T T, so that the second camera center is -c and its rays are Rt (bx, by, 1).
+    */
+
+    inline bool triangulate_point(const mat3 &R, const vec3 &T, const mat3 &Rt, const vec3 &c, float ax, float ay, float bx, float by, float fx, float fy, float max_error_square, float &x, float &y, float &z, float &parallax) {
+        float d2x = Rt(0, 0)*bx + Rt(0, 1)*by + Rt(0, 2);
+        float d2y = Rt(1, 0)*bx + Rt(1, 1)*by + Rt(1, 2);
+        float d2z = Rt(2, 0)*bx + Rt(2, 1)*by + Rt(2, 2);
+
+        // closest points s d1 and -c + t d2 of the rays d1 = (ax, ay, 1) and d2
+        float a = ax*ax + ay*ay + 1.0f;
+        float b = ax*d2x + ay*d2y + d2z;
+        float cc = d2x*d2x + d2y*d2y + d2z*d2z;
+        float d = ax*c(0) + ay*c(1) + c(2);
+        float e = d2x*c(0) + d2y*c(1) + d2z*c(2);
+        float denom = a*cc - b*b;
+        float s = (b*e - cc*d) / denom;
+        float t = (a*e - b*d) / denom;
+
+        x = 0.5f*(s*ax + t*d2x - c(0));
+        y = 0.5f*(s*ay + t*d2y - c(1));
+        z = 0.5f*(s + t*d2z - c(2));
+
+        float x2 = R(0, 0)*x + R(0, 1)*y + R(0, 2)*z + T(0);
+        float y2 = R(1, 0)*x + R(1, 1)*y + R(1, 2)*z + T(1);
+        float z2 = R(2, 0)*x + R(2, 1)*y + R(2, 2)*z + T(2);
+
+        float ex1 = (x / z - ax)*fx, ey1 = (y / z - ay)*fy;
+        float ex2 = (x2 / z2 - bx)*fx, ey2 = (y2 / z2 - by)*fy;
+
+        float vx = x + c(0), vy = y + c(1), vz = z + c(2);
+        parallax = (x*vx + y*vy + z*vz) / std::sqrt((x*x + y*y + z*z)*(vx*vx + vy*vy + vz*vz));
+
+        return denom > min_ray_sine_square*a*cc && z > 0 && z2 > 0
+            && ex1*ex1 + ey1*ey1 <= max_error_square && ex2*ex2 + ey2*ey2 <= max_error_square;
+    }
+
+    void triangulate_tail(const mat3 &R, const vec3 &T, const PairArray &pairs, size_t i, size_t begin, size_t end, float fx, float fy, float max_error_square, PointArray &points, float *parallax, std::uint64_t &mask) {
+        const mat3 Rt = R.transpose();
+        const vec3 c = Rt*T;
+        for (; i < end; ++i) {
+            if (triangulate_point(R, T, Rt, c, pairs.ax[i], pairs.ay[i], pairs.bx[i], pairs.by[i], fx, fy, max_error_square, points.x[i], points.y[i], points.z[i], parallax[i])) {
+                mask |= std::uint64_t(1) << (i - begin);
+            }
+        }
+    }
+
+    void triangulate_scalar(const mat3 &R, const vec3 &T, const PairArray &pairs, size_t begin, size_t end, float fx, float fy, float max_error_square, PointArray &points, float *parallax, std::uint64_t &mask) {
+        mask = 0;
+        triangulate_tail(R, T, pairs, begin, begin, end, fx, fy, max_error_square, points, parallax, mask);
+    }
+
+#ifdef SLAM_TRIANGULATION_X86
+
+    // AVX2 generation: eight points per register, same arithmetic as the scalar kernel lane by lane.
+
+    SLAM_TARGET_AVX2 inline __m256 mad(__m256 a, __m256 b, __m256 c) {
+        return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+    }
+
+    SLAM_TARGET_AVX2 void triangulate_avx2(const mat3 &R, const vec3 &T, const PairArray &pairs, size_t begin, size_t end, float fx, float fy, float max_error_square, PointArray &points, float *parallax, std::uint64_t &mask) {
+        const mat3 Rt = R.transpose();
+        const vec3 c = Rt*T;
+        const __m256 r00 = _mm256_set1_ps(R(0, 0)), r01 = _mm256_set1_ps(R(0, 1)), r02 = _mm256_set1_ps(R(0, 2));
+        const __m256 r10 = _mm256_set1_ps(R(1, 0)), r11 = _mm256_set1_ps(R(1, 1)), r12 = _mm256_set1_ps(R(1, 2));
+        const __m256 r20 = _mm256_set1_ps(R(2, 0)), r21 = _mm256_set1_ps(R(2, 1)), r22 = _mm256_set1_ps(R(2, 2));
+        const __m256 t0 = _mm256_set1_ps(T(0)), t1 = _mm256_set1_ps(T(1)), t2 = _mm256_set1_ps(T(2));
+        const __m256 q00 = _mm256_set1_ps(Rt(0, 0)), q01 = _mm256_set1_ps(Rt(0, 1)), q02 = _mm256_set1_ps(Rt(0, 2));
+        const __m256 q10 = _mm256_set1_ps(Rt(1, 0)), q11 = _mm256_set1_ps(Rt(1, 1)), q12 = _mm256_set1_ps(Rt(1, 2));
+        const __m256 q20 = _mm256_set1_ps(Rt(2, 0)), q21 = _mm256_set1_ps(Rt(2, 1)), q22 = _mm256_set1_ps(Rt(2, 2));
+        const __m256 c0 = _mm256_set1_ps(c(0)), c1 = _mm256_set1_ps(c(1)), c2 = _mm256_set1_ps(c(2));
+        const __m256 vfx = _mm256_set1_ps(fx), vfy = _mm256_set1_ps(fy);
+        const __m256 threshold = _mm256_set1_ps(max_error_square);
+        const __m256 min_sine = _mm256_set1_ps(min_ray_sine_square);
+        const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+
+        mask = 0;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 ax = _mm256_loadu_ps(&pairs.ax[i]), ay = _mm256_loadu_ps(&pairs.ay[i]);
+            __m256 bx = _mm256_loadu_ps(&pairs.bx[i]), by = _mm256_loadu_ps(&pairs.by[i]);
+            __m256 d2x = _mm256_add_ps(mad(q01, by, _mm256_mul_ps(q00, bx)), q02);
+            __m256 d2y = _mm256_add_ps(mad(q11, by, _mm256_mul_ps(q10, bx)), q12);
+            __m256 d2z = _mm256_add_ps(mad(q21, by, _mm256_mul_ps(q20, bx)), q22);
+
+            __m256 a = _mm256_add_ps(mad(ay, ay, _mm256_mul_ps(ax, ax)), one);
+            __m256 b = _mm256_add_ps(mad(ay, d2y, _mm256_mul_ps(ax, d2x)), d2z);
+            __m256 cc = mad(d2z, d2z, mad(d2y, d2y, _mm256_mul_ps(d2x, d2x)));
+            __m256 d = _mm256_add_ps(mad(ay, c1, _mm256_mul_ps(ax, c0)), c2);
+            __m256 e = mad(d2z, c2, mad(d2y, c1, _mm256_mul_ps(d2x, c0)));
+            __m256 denom = _mm256_sub_ps(_mm256_mul_ps(a, cc), _mm256_mul_ps(b, b));
+            __m256 s = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(b, e), _mm256_mul_ps(cc, d)), denom);
+            __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(a, e), _mm256_mul_ps(b, d)), denom);
+
+            __m256 x = _mm256_mul_ps(half, _mm256_sub_ps(mad(t, d2x, _mm256_mul_ps(s, ax)), c0));
+            __m256 y = _mm256_mul_ps(half, _mm256_sub_ps(mad(t, d2y, _mm256_mul_ps(s, ay)), c1));
+            __m256 z = _mm256_mul_ps(half, _mm256_sub_ps(mad(t, d2z, s), c2));
+
+            __m256 x2 = _mm256_add_ps(mad(r02, z, mad(r01, y, _mm256_mul_ps(r00, x))), t0);
+            __m256 y2 = _mm256_add_ps(mad(r12, z, mad(r11, y, _mm256_mul_ps(r10, x))), t1);
+            __m256 z2 = _mm256_add_ps(mad(r22, z, mad(r21, y, _mm256_mul_ps(r20, x))), t2);
+
+            __m256 ex1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(x, z), ax), vfx);
+            __m256 ey1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(y, z), ay), vfy);
+            __m256 ex2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(x2, z2), bx), vfx);
+            __m256 ey2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_div_ps(y2, z2), by), vfy);
+
+            __m256 vx = _mm256_add_ps(x, c0), vy = _mm256_add_ps(y, c1), vz = _mm256_add_ps(z, c2);
+            __m256 dot = mad(z, vz, mad(y, vy, _mm256_mul_ps(x, vx)));
+            __m256 norms = _mm256_mul_ps(mad(z, z, mad(y, y, _mm256_mul_ps(x, x))), mad(vz, vz, mad(vy, vy, _mm256_mul_ps(vx, vx))));
+
+            __m256 valid = _mm256_cmp_ps(denom, _mm256_mul_ps(min_sine, _mm256_mul_ps(a, cc)), _CMP_GT_OQ);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(z, zero, _CMP_GT_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(z2, zero, _CMP_GT_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(mad(ey1, ey1, _mm256_mul_ps(ex1, ex1)), threshold, _CMP_LE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(mad(ey2, ey2, _mm256_mul_ps(ex2, ex2)), threshold, _CMP_LE_OQ));
+
+            _mm256_storeu_ps(&points.x[i], x);
+            _mm256_storeu_ps(&points.y[i], y);
+            _mm256_storeu_ps(&points.z[i], z);
+            _mm256_storeu_ps(&parallax[i], _mm256_div_ps(dot, _mm256_sqrt_ps(norms)));
+            mask |= (std::uint64_t)_mm256_movemask_ps(valid) << (i - begin);
+        }
+        triangulate_tail(R, T, pairs, i, begin, end, fx, fy, max_error_square, points, parallax, mask);
+    }
+
+#endif
+
+    TriangulationKernel select_kernel() {
+#ifdef SLAM_TRIANGULATION_X86
+        if (cpu_features().avx2) {
+            return TriangulationKernel{ "avx2", triangulate_avx2 };
+        }
+#endif
+        return TriangulationKernel{ "scalar", triangulate_scalar };
+    }
+
+    const TriangulationKernel &kernel() {
+        static const TriangulationKernel k = select_kernel();
+        return k;
+    }
+
+}
+
+void slam::triangulate_pairs(const mat3 &R, const vec3 &T, const PairArray &pairs, size_t begin, size_t end, float fx, float fy, float max_error_square, PointArray &points, float *parallax, std::uint64_t &mask) {
+    kernel().triangulate(R, T, pairs, begin, end, fx, fy, max_error_square, points, parallax, mask);
+}
+
+const char *slam::triangulation_kernel_name() {
+    return kernel().name;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include "AlignedAllocator.h"
+#include "ScoreKernels.h"
+#include "Types.h"
+
+namespace slam {
+
+    // Triangulated points stored as separate coordinate arrays.
+    struct PointArray {
+        aligned_vector<float> x, y, z;
+
+        void resize(size_t n) {
+            x.resize(n);
+            y.resize(n);
+            z.resize(n);
+        }
+
+        size_t size() const { return x.size(); }
+    };
+
+    /*
+    Triangulation of n <= 64 point pairs [begin, end) seen by the cameras x = P and x = R P + T,
+    by the midpoint of the closest approach of the two rays. Bit i - begin of mask is set for a
+    point in front of both cameras whose reprojection error in each image is within max_error_square
+    pixels squared; points and parallax (cosine of the angle between the rays) are written for those.
+    Normalized coordinates as in ScoreKernels.h, fx, fy turn the errors into pixels.
+    */
+    void triangulate_pairs(const mat3 &R, const vec3 &T, const PairArray &pairs, size_t begin, size_t end, float fx, float fy, float max_error_square, PointArray &points, float *parallax, std::uint64_t &mask);
+
+    // Name of the kernels picked for this CPU: "avx2" or "scalar".
+    const char *triangulation_kernel_name();
+
+}
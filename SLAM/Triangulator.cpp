@@ -1,5 +1,7 @@
 #include "Triangulator.h"
 #include <algorithm>
+#include <array>
+#include "ThreadPool.h"
 
 using namespace slam;
 
@@ -13,180 +15,176 @@ Triangulator::Triangulator(const mat3 & K, real sigma)
 
 Triangulator::~Triangulator() = default;
 
-void Triangulator::set_dataset(const std::vector<vec2>& pa, const std::vector<vec2>& pb, const std::vector<std::pair<size_t, size_t>>& matches) {
+void Triangulator::set_dataset(const KeypointArray& pa, const KeypointArray& pb, const match_vector& matches) {
     m_ppa = &pa;
     m_ppb = &pb;
     m_pmatches = &matches;
+
+    m_pairs.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i) {
+        m_pairs.ax[i] = pa.x[matches[i].first];
+        m_pairs.ay[i] = pa.y[matches[i].first];
+        m_pairs.bx[i] = pb.x[matches[i].second];
+        m_pairs.by[i] = pb.y[matches[i].second];
+    }
+}
+
+void Triangulator::set_thread_pool(ThreadPool *pool) {
+    m_pool = pool;
 }
 
 void Triangulator::run(const mat3 & E) {
+    std::array<mat3, 4> Rs;
+    std::array<vec3, 4> Ts;
+    decompose_essential(E, Rs[0], Rs[1], Ts[0], Ts[2]);
+    Rs[2] = Rs[0]; Rs[3] = Rs[1];
+    Ts[1] = Ts[0]; Ts[3] = Ts[2];
+
+    choose_pose(Rs.data(), Ts.data(), 4);
+}
+
+void Triangulator::run_planar(const mat3 & H) {
+    std::array<mat3, 8> Rs;
+    std::array<vec3, 8> Ts;
+    size_t count = decompose_homography(H, Rs, Ts);
+
+    choose_pose(Rs.data(), Ts.data(), count);
+}
+
+void Triangulator::Hypothesis::reset(size_t n) {
+    points.resize(n);
+    inlier_set.resize(n);
+    parallaxes.resize(n);
+    count = 0;
+    live = true;
+}
+
+void Triangulator::choose_pose(const mat3 *Rs, const vec3 *Ts, size_t count) {
     R = mat3::Identity();
     T = vec3::Zero();
     points.clear();
     matches.clear();
     parallax = 1.0f;
-
-    mat3 R1, R2; vec3 T1, T2;
-    decompose_essential(E, R1, R2, T1, T2);
-
-    size_t N = m_pmatches->size();
-    std::vector<vec3> points1(N), points2(N), points3(N), points4(N);
-    std::vector<bool> inliers1(N, false), inliers2(N, false), inliers3(N, false), inliers4(N, false);
-    real rparallax1, rparallax2, rparallax3, rparallax4;
-
-#ifdef USE_PARALLEL_TRIANGULATION
-    std::future<size_t> t1 = std::async(std::launch::async, &Triangulator::try_triangulate, this, R1, T1, std::ref(points1), std::ref(inliers1)/*, std::cref(terminate_signal)*/);
-    std::future<size_t> t2 = std::async(std::launch::async, &Triangulator::try_triangulate, this, R2, T1, std::ref(points2), std::ref(inliers2)/*, std::cref(terminate_signal)*/);
-    std::future<size_t> t3 = std::async(std::launch::async, &Triangulator::try_triangulate, this, R1, T2, std::ref(points3), std::ref(inliers3)/*, std::cref(terminate_signal)*/);
-    std::future<size_t> t4 = std::async(std::launch::async, &Triangulator::try_triangulate, this, R2, T2, std::ref(points4), std::ref(inliers4)/*, std::cref(terminate_signal)*/);
-
-    size_t count1 = t1.get();
-    size_t count2 = t2.get();
-    size_t count3 = t3.get();
-    size_t count4 = t4.get();
-#else
-    size_t count1 = try_triangulate(R1, T1, points1, inliers1, rparallax1);
-    size_t count2 = try_triangulate(R2, T1, points2, inliers2, rparallax2);
-    size_t count3 = try_triangulate(R1, T2, points3, inliers3, rparallax3);
-    size_t count4 = try_triangulate(R2, T2, points4, inliers4, rparallax4);
-#endif
-
-    size_t max_count = std::max(std::max(count1, count2), std::max(count3, count4));
-
-    size_t similar_count = 0;
-    similar_count += ((count1 * 4 > max_count * 3) ? 1 : 0);
-    similar_count += ((count2 * 4 > max_count * 3) ? 1 : 0);
-    similar_count += ((count3 * 4 > max_count * 3) ? 1 : 0);
-    similar_count += ((count4 * 4 > max_count * 3) ? 1 : 0);
-
-    if (similar_count != 1) {
-        // Ambiguious
+    if (count == 0) {
         return;
     }
 
-    std::vector<vec3> *ppoints = nullptr;
-    std::vector<bool> *pinliers = nullptr;
-    if (max_count == count1) {
-        R = R1; T = T1;
-        ppoints = &points1;
-        pinliers = &inliers1;
-        parallax = rparallax1;
-    }
-    else if (max_count == count2) {
-        R = R2; T = T1;
-        ppoints = &points2;
-        pinliers = &inliers2;
-        parallax = rparallax2;
-    }
-    else if (max_count == count3) {
-        R = R1; T = T2;
-        ppoints = &points3;
-        pinliers = &inliers3;
-        parallax = rparallax3;
+    size_t N = m_pairs.size();
+    size_t word_count = (N + InlierMask::word_bits - 1) / InlierMask::word_bits;
+    if (m_hypotheses.size() < count) {
+        m_hypotheses.resize(count);
     }
-    else if (max_count == count4) {
-        R = R2; T = T2;
-        ppoints = &points4;
-        pinliers = &inliers4;
-        parallax = rparallax4;
+    for (size_t h = 0; h < count; ++h) {
+        m_hypotheses[h].reset(N);
     }
-    std::vector<vec3> &rpoints = *ppoints;
-    std::vector<bool> &rinliers = *pinliers;
-    const std::vector<std::pair<size_t, size_t>> &rmatches = *m_pmatches;
-    points.reserve(N);
-    matches.reserve(N);
-    for (size_t i = 0; i < N; ++i) {
-        if (rinliers[i]) {
-            points.push_back(rpoints[i]);
-            matches.push_back(rmatches[i]);
+
+    std::vector<size_t> live;
+    for (size_t word_begin = 0; word_begin < word_count; word_begin += round_words) {
+        size_t word_end = std::min(word_begin + round_words, word_count);
+        live.clear();
+        for (size_t h = 0; h < count; ++h) {
+            if (m_hypotheses[h].live) {
+                live.push_back(h);
+            }
         }
-    }
-    points.shrink_to_fit();
-    matches.shrink_to_fit();
-}
 
-void Triangulator::triangulate() {
-    points.clear();
-    matches.clear();
+        auto run_hypothesis = [&](size_t j) {
+            size_t h = live[j];
+            triangulate_words(Rs[h], Ts[h], m_hypotheses[h], word_begin, word_end);
+        };
+        if (m_pool && live.size() > 1) {
+            m_pool->parallel_for(live.size(), run_hypothesis);
+        }
+        else {
+            for (size_t j = 0; j < live.size(); ++j) {
+                run_hypothesis(j);
+            }
+        }
 
-    const match_vector &rmatches = *m_pmatches;
-    size_t N = rmatches.size();
-    std::vector<vec3> rpoints(N);
-    std::vector<bool> rinliers(N, false);
-    real rparallax;
-
-    try_triangulate(R, T, rpoints, rinliers, rparallax);
-
-    points.reserve(N);
-    matches.reserve(N);
-    for (size_t i = 0; i < N; ++i) {
-        if (rinliers[i]) {
-            points.push_back(rpoints[i]);
-            matches.push_back(rmatches[i]);
+        // a hypothesis that stays below 3/4 of the leader even if every remaining point passes is out
+        size_t remaining = N - std::min(word_end * InlierMask::word_bits, N);
+        size_t lead = 0;
+        for (size_t h : live) {
+            lead = std::max(lead, m_hypotheses[h].count);
+        }
+        for (size_t h : live) {
+            if ((m_hypotheses[h].count + remaining) * 4 <= lead * 3) {
+                m_hypotheses[h].live = false;
+            }
         }
     }
-    points.shrink_to_fit();
-    matches.shrink_to_fit();
-}
-
-size_t Triangulator::try_triangulate(const mat3 & R, const vec3 & T, std::vector<vec3>& triangulated, std::vector<bool>& inlier_set, real &rparallax) const {
-    const std::vector<vec2> &pa = *m_ppa;
-    const std::vector<vec2> &pb = *m_ppb;
-    const std::vector<std::pair<size_t, size_t>> &rmatches = *m_pmatches;
-
-    std::vector<real> parallaxes(rmatches.size(), 1.0f);
-
-    size_t good_count = 0;
-
-    vec3 C2 = -R.transpose()*T;
-
-    for (size_t i = 0; i < rmatches.size(); ++i) {
-        const vec2 &p1 = pa[rmatches[i].first];
-        const vec2 &p2 = pb[rmatches[i].second];
-
-        vec3 P1 = triangulate2(mat3::Identity(), vec3::Zero(), p1, R, T, p2);
 
-        if (!P1.allFinite()) {
-            continue;
+    size_t best = 0;
+    for (size_t h = 1; h < count; ++h) {
+        if (m_hypotheses[h].count > m_hypotheses[best].count) {
+            best = h;
         }
+    }
+    size_t max_count = m_hypotheses[best].count;
 
-        vec3 P2 = R*P1 + T;
+    size_t similar_count = 0;
+    for (size_t h = 0; h < count; ++h) {
+        similar_count += ((m_hypotheses[h].count * 4 > max_count * 3) ? 1 : 0);
+    }
 
-        vec3 n1 = P1.normalized();
-        vec3 n2 = (P1 - C2).normalized();
+    if (similar_count != 1) {
+        // Ambiguious
+        return;
+    }
 
-        real parallax = n1.dot(n2);
+    R = Rs[best]; T = Ts[best];
+    parallax = parallax_percentile(m_hypotheses[best]);
+    collect(m_hypotheses[best]);
+}
 
-        if (P1.z() <= 0 || P2.z() <= 0) {
-            continue;
-        }
+void Triangulator::triangulate() {
+    points.clear();
+    matches.clear();
 
-        vec2 diff1 = project(P1) - p1;
-        vec2 diff2 = project(P2) - p2;
+    size_t N = m_pairs.size();
+    if (m_hypotheses.empty()) {
+        m_hypotheses.resize(1);
+    }
+    Hypothesis &h = m_hypotheses[0];
+    h.reset(N);
+    triangulate_words(R, T, h, 0, (N + InlierMask::word_bits - 1) / InlierMask::word_bits);
+    collect(h);
+}
 
-        diff1.x() *= K(0, 0);
-        diff1.y() *= K(1, 1);
-        diff2.x() *= K(0, 0);
-        diff2.y() *= K(1, 1);
+void Triangulator::triangulate_words(const mat3 & R, const vec3 & T, Hypothesis &h, size_t word_begin, size_t word_end) const {
+    size_t N = m_pairs.size();
+    for (size_t w = word_begin; w < word_end; ++w) {
+        size_t begin = w * InlierMask::word_bits;
+        size_t end = std::min(begin + InlierMask::word_bits, N);
+        triangulate_pairs(R, T, m_pairs, begin, end, K(0, 0), K(1, 1), m_sigma2, h.points, h.parallaxes.data(), h.inlier_set.word(w));
+        h.count += popcount(h.inlier_set.word(w));
+    }
+}
 
-        if (diff1.squaredNorm() > m_sigma2 || diff2.squaredNorm() > m_sigma2) {
-            continue;
+real Triangulator::parallax_percentile(Hypothesis &h) {
+    // only the percentile needs to be in place
+    size_t k = 0;
+    for (size_t i = 0; i < h.inlier_set.size(); ++i) {
+        if (h.inlier_set[i]) {
+            h.parallaxes[k++] = h.parallaxes[i];
         }
-
-        parallaxes[i] = parallax;
-        triangulated[i] = P1;
-        inlier_set[i] = true;
-        good_count++;
     }
-
-    rparallax = 1.0f;
-    std::sort(parallaxes.begin(), parallaxes.end());
-    size_t valid_start = 0;
-    for (valid_start = 0; valid_start < parallaxes.size() && parallaxes[valid_start] == 1.0f; ++valid_start);
-    if (valid_start < parallaxes.size()) {
-        size_t id = valid_start + (parallaxes.size() - valid_start) * 2 / 3;
-        rparallax = parallaxes[id];
+    if (k == 0) {
+        return 1.0f;
     }
+    auto nth = h.parallaxes.begin() + k * 2 / 3;
+    std::nth_element(h.parallaxes.begin(), nth, h.parallaxes.begin() + k);
+    return *nth;
+}
 
-    return good_count;
+void Triangulator::collect(const Hypothesis &h) {
+    const match_vector &rmatches = *m_pmatches;
+    points.reserve(h.count);
+    matches.reserve(h.count);
+    for (size_t i = 0; i < rmatches.size(); ++i) {
+        if (h.inlier_set[i]) {
+            points.emplace_back(h.points.x[i], h.points.y[i], h.points.z[i]);
+            matches.push_back(rmatches[i]);
+        }
+    }
 }
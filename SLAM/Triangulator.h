@@ -1,35 +1,75 @@
 #pragma once
 
 #include <algorithm>
-#include <future>
 #include "Types.h"
 #include "Geometry.h"
+#include "RANSAC.h"
+#include "TriangulationKernels.h"
 
 namespace slam {
 
+    class ThreadPool;
+
     class Triangulator {
     public:
         mat3 R;
         vec3 T;
         std::vector<vec3> points;
-        std::vector<std::pair<size_t, size_t>> matches;
+        match_vector matches;
         real parallax;
 
         Triangulator(const mat3 &K, real sigma);
         ~Triangulator();
 
-        void set_dataset(const std::vector<vec2> &pa, const std::vector<vec2> &pb, const std::vector<std::pair<size_t, size_t>> &matches);
+        void set_dataset(const KeypointArray &pa, const KeypointArray &pb, const match_vector &matches);
+
+        // Try the pose hypotheses of run and run_planar on the threads of pool; nullptr runs serially.
+        void set_thread_pool(ThreadPool *pool);
 
+        // Pose from an essential matrix, out of its 4 decompositions.
         void run(const mat3 &E);
 
+        // Pose from the homography of a plane, out of its 8 decompositions.
+        void run_planar(const mat3 &H);
+
         void triangulate();
 
     private:
-        size_t try_triangulate(const mat3 &R, const vec3 &T, std::vector<vec3> &triangulated, std::vector<bool> &inlier_set, real &rparallax) const;
+        struct Hypothesis {
+            PointArray points;
+            InlierMask inlier_set;
+            std::vector<float> parallaxes;
+            size_t count;
+            bool live;
+
+            void reset(size_t n);
+        };
+
+        /*
+        Keep the hypothesis with clearly the most points in front of both cameras, none when ambiguous.
+        Hypotheses are triangulated in rounds of round_words mask words and dropped as soon as
+        they cannot come close to the leader anymore, whatever the remaining points give.
+        */
+        void choose_pose(const mat3 *Rs, const vec3 *Ts, size_t count);
+
+        // Pairs of mask words [word_begin, word_end) under pose R, T.
+        void triangulate_words(const mat3 &R, const vec3 &T, Hypothesis &h, size_t word_begin, size_t word_end) const;
+
+        // 2/3 percentile of the inliers' parallax, reorders h.parallaxes.
+        static real parallax_percentile(Hypothesis &h);
+
+        // Inliers of a hypothesis as the result points and matches.
+        void collect(const Hypothesis &h);
+
+        static const size_t round_words = 16;
+
+        const KeypointArray *m_ppa = nullptr;
+        const KeypointArray *m_ppb = nullptr;
+        const match_vector *m_pmatches = nullptr;
 
-        const std::vector<vec2> *m_ppa = nullptr;
-        const std::vector<vec2> *m_ppb = nullptr;
-        const std::vector<std::pair<size_t, size_t>> *m_pmatches = nullptr;
+        PairArray m_pairs; // matched points, gathered by set_dataset
+        std::vector<Hypothesis> m_hypotheses;
+        ThreadPool *m_pool = nullptr;
 
         mat3 K;
         real m_sigma2;
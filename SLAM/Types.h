@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <utility>
 #include <vector>
 #include <Eigen/Eigen>
+#include "AlignedAllocator.h"
 
 namespace slam {
 
@@ -39,6 +41,32 @@ namespace slam {
     typedef matxf matx;
     typedef quatf quat;
 
-    typedef std::vector<std::pair<size_t, size_t>> match_vector;
+    // Keypoint, landmark and keyframe ids are 32-bit; invalid_index marks "none".
+    typedef std::uint32_t index_t;
+    const index_t invalid_index = index_t(-1);
+
+    typedef std::vector<std::pair<index_t, index_t>> match_vector;
+
+    // Structure-of-arrays 2D points, x and y stored in separate contiguous arrays.
+    class KeypointArray {
+    public:
+        aligned_vector<real> x;
+        aligned_vector<real> y;
+
+        size_t size() const { return x.size(); }
+        bool empty() const { return x.empty(); }
+
+        void resize(size_t n) {
+            x.resize(n);
+            y.resize(n);
+        }
+
+        vec2 operator[](size_t i) const { return vec2(x[i], y[i]); }
+
+        void set(size_t i, const vec2 &p) {
+            x[i] = p.x();
+            y[i] = p.y();
+        }
+    };
 
 }
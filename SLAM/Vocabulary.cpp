@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "Vocabulary.h"
+#include "Random.h"
+
+using namespace slam;
+
+namespace {
+
+    const char vocabulary_magic[8] = { 'S', 'L', 'A', 'M', 'V', 'O', 'C', '1' };
+
+    // Bitwise majority of the cluster members, ties set the bit.
+    void majority_center(const std::vector<const std::uint8_t *> &members, std::uint8_t *center) {
+        int counter[descriptor_bytes * 8] = { 0 };
+        for (const std::uint8_t *d : members) {
+            for (size_t b = 0; b < descriptor_bytes; ++b) {
+                for (int bit = 0; bit < 8; ++bit) {
+                    counter[b * 8 + bit] += (d[b] >> (7 - bit)) & 1;
+                }
+            }
+        }
+        int n = (int)members.size();
+        for (size_t b = 0; b < descriptor_bytes; ++b) {
+            std::uint8_t byte = 0;
+            for (int bit = 0; bit < 8; ++bit) {
+                if (counter[b * 8 + bit] * 2 >= n) {
+                    byte |= (std::uint8_t)(1 << (7 - bit));
+                }
+            }
+            center[b] = byte;
+        }
+    }
+
+}
+
+Vocabulary::Vocabulary() : m_branching(0), m_depth(0) {}
+
+Vocabulary::~Vocabulary() = default;
+
+void Vocabulary::train(const std::vector<DescriptorArray> &images, int branching, int depth) {
+    m_branching = branching;
+    m_depth = depth;
+    m_nodes.clear();
+    m_centers.clear();
+    m_word_nodes.clear();
+
+    std::vector<const std::uint8_t *> descriptors;
+    for (auto &image : images) {
+        for (size_t i = 0; i < image.size(); ++i) {
+            descriptors.push_back(image[i]);
+        }
+    }
+
+    // root has no center
+    m_nodes.push_back(Node{ 0, 0, invalid_index, 0.0f });
+    m_centers.resize(1);
+    memset(m_centers[0], 0, descriptor_bytes);
+
+    if (descriptors.empty()) {
+        return;
+    }
+
+    build_children(0, descriptors, 1);
+
+    // idf weight: log(N / n_i), n_i the number of training images containing word i
+    std::vector<size_t> document_count(m_word_nodes.size(), 0);
+    std::vector<size_t> last_image(m_word_nodes.size(), size_t(-1));
+    for (size_t n = 0; n < images.size(); ++n) {
+        for (size_t i = 0; i < images[n].size(); ++i) {
+            index_t w = word(images[n][i]);
+            if (last_image[w] != n) {
+                last_image[w] = n;
+                document_count[w]++;
+            }
+        }
+    }
+    for (size_t w = 0; w < m_word_nodes.size(); ++w) {
+        m_nodes[m_word_nodes[w]].weight = document_count[w] > 0 ? (real)std::log((double)images.size() / document_count[w]) : 0.0f;
+    }
+}
+
+void Vocabulary::build_children(index_t node, std::vector<const std::uint8_t *> &descriptors, int level) {
+    size_t k = (size_t)m_branching;
+    size_t n = descriptors.size();
+
+    DescriptorArray centers;
+    std::vector<std::vector<const std::uint8_t *>> clusters;
+
+    if (n <= k) {
+        centers.resize(n);
+        clusters.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(centers[i], descriptors[i], descriptor_bytes);
+            clusters[i].push_back(descriptors[i]);
+        }
+    }
+    else {
+        // k-means++ seeding
+        UniformInteger<size_t> dice;
+        UniformNoise<double> coin;
+        std::vector<const std::uint8_t *> seeds;
+        std::vector<double> min_distance2(n, 1.0e30);
+
+        seeds.push_back(descriptors[dice.next(0, n - 1)]);
+        while (seeds.size() < k) {
+            double total = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double d = hamming_distance(descriptors[i], seeds.back());
+                min_distance2[i] = std::min(min_distance2[i], d*d);
+                total += min_distance2[i];
+            }
+            if (total <= 0) {
+                break; // every descriptor coincides with a seed
+            }
+            double r = coin.next()*total;
+            size_t pick = 0;
+            for (pick = 0; pick + 1 < n; ++pick) {
+                r -= min_distance2[pick];
+                if (r <= 0 && min_distance2[pick] > 0) {
+                    break;
+                }
+            }
+            seeds.push_back(descriptors[pick]);
+        }
+
+        centers.resize(seeds.size());
+        for (size_t c = 0; c < seeds.size(); ++c) {
+            memcpy(centers[c], seeds[c], descriptor_bytes);
+        }
+
+        // k-medians with bitwise majority centers, until the assignment is stable
+        std::vector<size_t> assignment(n, size_t(-1));
+        for (int iter = 0; iter < 20; ++iter) {
+            bool changed = false;
+            for (size_t i = 0; i < n; ++i) {
+                HammingMatch best;
+                hamming_knn(descriptors[i], centers.data(), centers.size(), 1, &best);
+                if (best.index != assignment[i]) {
+                    assignment[i] = best.index;
+                    changed = true;
+                }
+            }
+
+            clusters.assign(centers.size(), std::vector<const std::uint8_t *>());
+            for (size_t i = 0; i < n; ++i) {
+                clusters[assignment[i]].push_back(descriptors[i]);
+            }
+
+            if (!changed) {
+                break;
+            }
+
+            for (size_t c = 0; c < centers.size(); ++c) {
+                if (!clusters[c].empty()) {
+                    majority_center(clusters[c], centers[c]);
+                }
+            }
+        }
+
+        // drop clusters that ended up empty
+        size_t kept = 0;
+        for (size_t c = 0; c < clusters.size(); ++c) {
+            if (!clusters[c].empty()) {
+                if (kept != c) {
+                    memcpy(centers[kept], centers[c], descriptor_bytes);
+                    clusters[kept].swap(clusters[c]);
+                }
+                kept++;
+            }
+        }
+        clusters.resize(kept);
+        centers.resize(kept);
+    }
+
+    // children of a node are contiguous
+    index_t first = (index_t)m_nodes.size();
+    m_nodes.resize(first + centers.size(), Node{ 0, 0, invalid_index, 0.0f });
+    m_centers.resize(first + centers.size());
+    memcpy(m_centers[first], centers.data(), centers.size() * descriptor_bytes);
+    m_nodes[node].first_child = first;
+    m_nodes[node].child_count = (index_t)centers.size();
+
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        index_t child = first + (index_t)c;
+        if (level < m_depth && clusters[c].size() > 1) {
+            build_children(child, clusters[c], level + 1);
+        }
+        else {
+            m_nodes[child].word_id = (index_t)m_word_nodes.size();
+            m_word_nodes.push_back(child);
+        }
+    }
+}
+
+bool Vocabulary::load(const std::string &filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open vocabulary file: " << filepath << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(vocabulary_magic)];
+    std::int32_t branching = 0, depth = 0;
+    std::uint32_t node_count = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char *)&branching, sizeof(branching));
+    file.read((char *)&depth, sizeof(depth));
+    file.read((char *)&node_count, sizeof(node_count));
+    if (!file || memcmp(magic, vocabulary_magic, sizeof(magic)) != 0 || branching <= 0 || depth <= 0) {
+        std::cerr << "Invalid vocabulary file: " << filepath << std::endl;
+        return false;
+    }
+
+    // a node count the file cannot hold would only allocate for nothing
+    const std::streamoff node_bytes = 3 * sizeof(index_t) + sizeof(real) + descriptor_bytes;
+    std::streamoff header_end = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff file_end = file.tellg();
+    file.seekg(header_end);
+    if (file_end - header_end < (std::streamoff)node_count * node_bytes) {
+        std::cerr << "Truncated vocabulary file: " << filepath << std::endl;
+        return false;
+    }
+
+    m_branching = branching;
+    m_depth = depth;
+    m_nodes.resize(node_count);
+    m_centers.resize(node_count);
+    m_word_nodes.clear();
+    std::uint32_t i = 0;
+    for (; i < node_count; ++i) {
+        Node &n = m_nodes[i];
+        file.read((char *)&n.first_child, sizeof(n.first_child));
+        file.read((char *)&n.child_count, sizeof(n.child_count));
+        file.read((char *)&n.word_id, sizeof(n.word_id));
+        file.read((char *)&n.weight, sizeof(n.weight));
+        file.read((char *)m_centers[i], descriptor_bytes);
+
+        // children come after their parent and within the tree, lookups follow them unchecked;
+        // the leaves are exactly the words, each id given once, but for the lone root of an empty vocabulary
+        bool valid = n.child_count <= (index_t)branching &&
+            (n.child_count == 0 || (n.first_child > i && n.first_child <= node_count && n.child_count <= node_count - n.first_child)) &&
+            ((n.child_count == 0) == (n.word_id != invalid_index) || node_count == 1) &&
+            (n.word_id == invalid_index || n.word_id < node_count);
+        if (!file || !valid) {
+            break;
+        }
+        if (n.word_id != invalid_index) {
+            if (m_word_nodes.size() <= n.word_id) {
+                m_word_nodes.resize(n.word_id + 1, invalid_index);
+            }
+            if (m_word_nodes[n.word_id] != invalid_index) {
+                break;
+            }
+            m_word_nodes[n.word_id] = i;
+        }
+    }
+
+    // and the ids leave no gap
+    bool complete = std::find(m_word_nodes.begin(), m_word_nodes.end(), invalid_index) == m_word_nodes.end();
+    if (!file || i < node_count || !complete) {
+        std::cerr << (file ? "Invalid" : "Truncated") << " vocabulary file: " << filepath << std::endl;
+        m_nodes.clear();
+        m_centers.clear();
+        m_word_nodes.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool Vocabulary::save(const std::string &filepath) const {
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot write vocabulary file: " << filepath << std::endl;
+        return false;
+    }
+
+    std::int32_t branching = m_branching, depth = m_depth;
+    std::uint32_t node_count = (std::uint32_t)m_nodes.size();
+    file.write(vocabulary_magic, sizeof(vocabulary_magic));
+    file.write((const char *)&branching, sizeof(branching));
+    file.write((const char *)&depth, sizeof(depth));
+    file.write((const char *)&node_count, sizeof(node_count));
+    for (std::uint32_t i = 0; i < node_count; ++i) {
+        const Node &n = m_nodes[i];
+        file.write((const char *)&n.first_child, sizeof(n.first_child));
+        file.write((const char *)&n.child_count, sizeof(n.child_count));
+        file.write((const char *)&n.word_id, sizeof(n.word_id));
+        file.write((const char *)&n.weight, sizeof(n.weight));
+        file.write((const char *)m_centers[i], descriptor_bytes);
+    }
+
+    return (bool)file;
+}
+
+bool Vocabulary::empty() const {
+    return m_word_nodes.empty();
+}
+
+size_t Vocabulary::word_count() const {
+    return m_word_nodes.size();
+}
+
+index_t Vocabulary::word(const std::uint8_t *descriptor) const {
+    if (empty()) {
+        return invalid_index;
+    }
+
+    index_t node = 0;
+    while (m_nodes[node].child_count > 0) {
+        const Node &n = m_nodes[node];
+        HammingMatch best;
+        hamming_knn(descriptor, m_centers[n.first_child], n.child_count, 1, &best);
+        node = n.first_child + best.index;
+    }
+    return m_nodes[node].word_id;
+}
+
+void Vocabulary::transform(const DescriptorArray &descriptors, BowVector &bow) const {
+    bow.clear();
+    if (empty()) {
+        return;
+    }
+
+    bow.reserve(descriptors.size());
+    for (size_t i = 0; i < descriptors.size(); ++i) {
+        index_t w = word(descriptors[i]);
+        if (w == invalid_index) {
+            continue;
+        }
+        real weight = m_nodes[m_word_nodes[w]].weight;
+        if (weight > 0) {
+            bow.emplace_back(w, weight);
+        }
+    }
+
+    // merge repeated words (tf) and L1 normalize
+    std::sort(bow.begin(), bow.end(), [](const std::pair<index_t, real> &a, const std::pair<index_t, real> &b) { return a.first < b.first; });
+    size_t n = 0;
+    real total = 0;
+    for (size_t i = 0; i < bow.size(); ++i) {
+        if (n > 0 && bow[n - 1].first == bow[i].first) {
+            bow[n - 1].second += bow[i].second;
+        }
+        else {
+            bow[n++] = bow[i];
+        }
+        total += bow[i].second;
+    }
+    bow.resize(n);
+    if (total > 0) {
+        for (auto &entry : bow) {
+            entry.second /= total;
+        }
+    }
+}
+
+real Vocabulary::score(const BowVector &a, const BowVector &b) {
+    // 1 - |a - b|_1 / 2, summed over the common words only
+    real s = 0;
+    auto ia = a.begin();
+    auto ib = b.begin();
+    while (ia != a.end() && ib != b.end()) {
+        if (ia->first < ib->first) {
+            ++ia;
+        }
+        else if (ib->first < ia->first) {
+            ++ib;
+        }
+        else {
+            s += std::abs(ia->second) + std::abs(ib->second) - std::abs(ia->second - ib->second);
+            ++ia;
+            ++ib;
+        }
+    }
+    return 0.5f*s;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Types.h"
+#include "Hamming.h"
+
+namespace slam {
+
+    // Sparse bag-of-words vector: (word id, weight), sorted by word id, L1 normalized.
+    typedef std::vector<std::pair<index_t, real>> BowVector;
+
+    /*
+    Vocabulary tree over binary descriptors, Galvez-Lopez and Tardos, 2012.
+    Every node has up to `branching` children whose centers are the bitwise majority
+    of the descriptors clustered under them; leaves at `depth` are the words,
+    weighted by their inverse document frequency in the training images.
+    */
+    class Vocabulary {
+    public:
+        Vocabulary();
+        ~Vocabulary();
+
+        // Each element of images holds the descriptors of one training image.
+        void train(const std::vector<DescriptorArray> &images, int branching = 10, int depth = 6);
+
+        bool load(const std::string &filepath);
+        bool save(const std::string &filepath) const;
+
+        bool empty() const;
+        size_t word_count() const;
+
+        index_t word(const std::uint8_t *descriptor) const;
+        void transform(const DescriptorArray &descriptors, BowVector &bow) const;
+
+        // L1 score in [0, 1], 1 for identical vectors.
+        static real score(const BowVector &a, const BowVector &b);
+
+    private:
+        struct Node {
+            index_t first_child;
+            index_t child_count;
+            index_t word_id;     // invalid_index for inner nodes
+            real weight;
+        };
+
+        void build_children(index_t node, std::vector<const std::uint8_t *> &descriptors, int level);
+
+        int m_branching;
+        int m_depth;
+
+        std::vector<Node> m_nodes;         // children of a node are stored contiguously
+        DescriptorArray m_centers;         // cluster center of each node, same order as m_nodes
+        std::vector<index_t> m_word_nodes; // node of each word
+    };
+
+}
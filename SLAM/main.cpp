@@ -1,12 +1,19 @@
+#include <string>
 #include "System.h"
 #include "UDPSocket.h"
 
-int main() {
+int main(int argc, char **argv) {
 
     udp::socket::startup();
 
     slam::System system;
-    int ret = system.run();
+    int ret = 0;
+    if (argc > 2 && std::string(argv[1]) == "--train-vocabulary") {
+        ret = system.train_vocabulary(argv[2]);
+    }
+    else {
+        ret = system.run();
+    }
 
     udp::socket::cleanup();
 